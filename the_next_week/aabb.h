@@ -1,6 +1,8 @@
 #ifndef AABBH
 #define AABBH
 
+#include "stats.h"
+
 // stands for 'axis aligned bounding box'
 // it is a box made up of axis-aligned planes which acts as a boundary or container for the objects you want to render
 // while rendering: when you check if a ray hits an object, for each ray you have to check every individual object in the scene to see if the ray hit it
@@ -20,14 +22,22 @@ class aabb
 {
 public:
 	aabb() {}
-	// _min and _max are opposite corners of the aabb
-	aabb(const point& a, const point& b) { _min = a; _max = b; }
+	// a and b are the min and max corners of the aabb
+	aabb(const point& a, const point& b) { bounds[0] = a; bounds[1] = b; }
+
+	point min() const { return bounds[0]; }
+	point max() const { return bounds[1]; }
 
-	point min() const { return _min; }
-	point max() const { return _max; }
+	// used by the surface area heuristic, the chance of a random ray hitting a box is proportional to its surface area
+	float surface_area() const
+	{
+		point d = bounds[1] - bounds[0];
+		return 2.0f*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+	}
 
 	bool hit(const ray& r, float t_min, float t_max) const
 	{
+		RT_STAT(box_tests);
 		for(int i = 0;
 			i < 3;
 			i++)
@@ -63,21 +73,22 @@ public:
 			//   -this means the ray origin is on one of the planes and the x component of the ray is 0
 			//   -we don't handle this in this code with the assumption that it won't happen very often
 
-			float inverse_dir = 1.0f / r.direction()[i];
-			float t0 = (min()[i] - r.origin()[i]) * inverse_dir;
-			float t1 = (max()[i] - r.origin()[i]) * inverse_dir;
-			if(inverse_dir < 0.0f)
-				std::swap(t0, t1);
+			// 1/Bx and the sign of Bx are worked out once when the ray is made (see ray.h)
+			// the sign picks which plane the ray enters through, so there is no swap, and there is no early out
+			// this leaves no branches for the cpu to mispredict, 3 axes of arithmetic is cheaper than one misprediction
+			int sign = r.sign(i);
+			float t0 = (bounds[sign][i] - r.A[i]) * r.inv_B[i];
+			float t1 = (bounds[1-sign][i] - r.A[i]) * r.inv_B[i];
 			t_min = t0 > t_min ? t0 : t_min;
 			t_max = t1 < t_max ? t1 : t_max;
-			if(t_max <= t_min)  // this accounts for normal cases and for cases where r.direction()[i] = 0
-				return false;
 		}
-		return true;
+		// this accounts for normal cases and for cases where r.direction()[i] = 0
+		// a NaN t0 or t1 (see above) fails its comparison, so the selects keep the old t_min or t_max and that axis doesn't narrow the range at all
+		return t_max > t_min;
 	}
 
-	point _min;
-	point _max;
+	// bounds[0] is the min corner and bounds[1] the max corner, kept in an array so hit() can pick one with the ray's sign
+	point bounds[2];
 };
 
 // create a large aabb that encompasses two smaller aabbs
@@ -0,0 +1,124 @@
+#ifndef ARENAH
+#define ARENAH
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+// owns everything a scene is made of: textures, materials, hitables, the lists of hitable pointers and the acceleration structures
+// objects are bump allocated one after another in big blocks, so the objects of a scene sit close together in memory instead of
+// being spread over the heap, and the whole scene is freed at once by clear() or the arena's destructor
+// ----
+// objects are made with make<T>(constructor arguments) instead of new T(...), and are never deleted one at a time
+// the destructors of objects that have one (e.g. ones holding std::vectors or image data) are run by clear(), newest first
+// so an object is always destroyed before anything made before it (which it may point at)
+class scene_arena
+{
+public:
+	scene_arena(size_t block_size = 256*1024) : default_block_size(block_size), bytes_used(0) {}
+	~scene_arena() { clear(); }
+
+	template<typename T, typename... argument_types>
+	T *make(argument_types&&... arguments)
+	{
+		T *object = new(allocate(sizeof(T), alignof(T))) T(std::forward<argument_types>(arguments)...);
+		if(!std::is_trivially_destructible<T>::value)
+		{
+			destructor_entry entry = { object, &destroy<T> };
+			destructors.push_back(entry);
+		}
+		return object;
+	}
+
+	// an array of n uninitialized T's, for plain types like the hitable * lists given to hitable_list and the bvh builders
+	template<typename T>
+	T *make_array(int n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "make_array doesn't run destructors");
+		return (T *)allocate(n*sizeof(T), alignof(T));
+	}
+
+	// destroys every object and frees every block, the arena can then be used for a new scene
+	void clear()
+	{
+		for(size_t i = destructors.size();
+			i > 0;
+			i--)
+		{
+			destructors[i-1].destroy(destructors[i-1].object);
+		}
+		destructors.clear();
+		for(size_t i = 0;
+			i < blocks.size();
+			i++)
+		{
+			free(blocks[i].memory);
+		}
+		blocks.clear();
+		bytes_used = 0;
+	}
+
+	size_t allocated_bytes() const { return bytes_used; }
+	int object_count_with_destructors() const { return (int)destructors.size(); }
+
+private:
+	struct block
+	{
+		char *memory;
+		size_t size;
+		size_t used;
+	};
+	struct destructor_entry
+	{
+		void *object;
+		void (*destroy)(void *object);
+	};
+
+	template<typename T>
+	static void destroy(void *object)
+	{
+		((T *)object)->~T();
+	}
+
+	void *allocate(size_t size, size_t alignment)
+	{
+		// the current block is always the last one, when something doesn't fit a new block is started (the rest of the old one is wasted)
+		if(!blocks.empty())
+		{
+			block& current = blocks.back();
+			size_t start = (current.used + alignment-1) & ~(alignment-1);
+			if(start + size <= current.size)
+			{
+				current.used = start + size;
+				bytes_used += size;
+				return current.memory + start;
+			}
+		}
+		// objects bigger than a block get a block of their own
+		block b;
+		b.size = size > default_block_size ? size : default_block_size;
+		// malloc's memory is aligned for any built in type, which is enough for everything in a scene
+		b.memory = (char *)malloc(b.size);
+		assert(b.memory);
+		b.used = size;
+		blocks.push_back(b);
+		bytes_used += size;
+		return b.memory;
+	}
+
+	// an arena can't be copied, the copy would free the same blocks again
+	scene_arena(const scene_arena&);
+	scene_arena& operator=(const scene_arena&);
+
+	size_t default_block_size;
+	size_t bytes_used;
+	std::vector<block> blocks;
+	std::vector<destructor_entry> destructors;
+};
+
+#endif
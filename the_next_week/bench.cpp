@@ -0,0 +1,928 @@
+#include "vec3.h"
+#include "util.h"
+#include "camera.h"
+#include "hitable.h"
+#include "scenes.h"
+#include "framebuffer.h"
+#include "render.h"
+#include "bvh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+// benchmarks for the renderer, built by bench_build.bat
+// results are printed as csv lines so runs can be diffed or loaded into a spreadsheet
+//
+// usage: bench <suite> [arguments]
+//   threads [scene] [samples]   rays per second rendering a scene with 1 to N threads
+//   bvh [scene] [samples]       build time, SAH cost and render speed of the bvh builders
+//   boxes [rays]                 ray-box slab tests per second, the current aabb::hit against the version that divided per test
+//   mesh [triangles] [samples]  obj load time, mesh bvh build time and render speed of a generated mesh
+//   cornell [samples]           the cornell box scene with its boxes as one slab test each against the boxes made of 6 rects they used to be
+//   arena [repeats]             builds and clears every scene repeatedly in one scene_arena, with the build time and memory of each
+//   kernels [rays]              ns per ray test of each primitive and wrapper on its own, with rays that mostly hit and rays that mostly miss
+//   scenes [samples] [threads]  renders every scene (and in_one_weekend's random_scene) with 1 to N threads, the baseline to judge changes against
+//   lights [samples]            checks light sampling doesn't change how bright a render is, exits with 1 if it does
+
+#ifdef LIBC_RAND
+static const char *RNG_NAME = "libc_rand";
+#else
+static const char *RNG_NAME = "pcg32";
+#endif
+
+// seconds between start and now
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// total rays traced by all threads
+uint64_t total_rays(const std::vector<worker_stats>& stats)
+{
+	uint64_t rays = 0;
+	for(size_t i = 0;
+		i < stats.size();
+		i++)
+	{
+		rays += stats[i].primary_rays + stats[i].secondary_rays + stats[i].shadow_rays;
+	}
+	return rays;
+}
+
+// 1, 2, 4 ... and always finishing on max_threads
+std::vector<int> benchmark_thread_counts(int max_threads)
+{
+	std::vector<int> thread_counts;
+	for(int n = 1;
+		n < max_threads;
+		n *= 2)
+	{
+		thread_counts.push_back(n);
+	}
+	thread_counts.push_back(max_threads);
+	return thread_counts;
+}
+
+// renders a scene with 1, 2, 4 ... up to the number of hardware threads and reports the throughput of each
+// build with and without LIBC_RAND defined (bench_build.bat makes both) to compare random number generators
+void bench_threads(int scene_num, int ns)
+{
+	scene_arena arena;
+	const int nx = 200;
+	const int ny = 100;
+	camera cam;
+	light_list lights;
+	hitable *world = create_scene(scene_num, arena, cam, lights, nx, ny);
+	framebuffer fb(nx, ny);
+	render_settings settings;
+	settings.ns = ns;
+
+	printf("suite,rng,scene,threads,seconds,rays,rays_per_sec,speedup\n");
+	std::vector<int> thread_counts = benchmark_thread_counts(default_thread_count());
+
+	double single_thread_rate = 0;
+	for(size_t run = 0;
+		run < thread_counts.size();
+		run++)
+	{
+		int thread_count = thread_counts[run];
+		settings.thread_count = thread_count;
+		std::vector<worker_stats> stats;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		render_image(world, lights, cam, settings, &fb, stats);
+		double seconds = seconds_since(start);
+		uint64_t rays = total_rays(stats);
+		double rate = rays / seconds;
+		if(thread_count == 1)
+			single_thread_rate = rate;
+		printf("threads,%s,%d,%d,%.3f,%llu,%.0f,%.2f\n", RNG_NAME, scene_num, thread_count, seconds, (unsigned long long)rays, rate, rate / single_thread_rate);
+	}
+}
+
+// builds a bvh over the scene's top level objects with each builder and renders with it
+void bench_bvh(int scene_num, int ns)
+{
+	scene_arena arena;
+	const int nx = 200;
+	const int ny = 100;
+	camera cam;
+	light_list lights;
+	// the builders are compared on the scene's own objects, without packing spheres into sphere_sets
+	hitable_list *scene = (hitable_list *)create_scene(scene_num, arena, cam, lights, nx, ny, ACCEL_LIST, false);
+	framebuffer fb(nx, ny);
+	render_settings settings;
+	settings.ns = ns;
+
+	struct bvh_config
+	{
+		const char *name;
+		bvh_split_method method;
+		int max_leaf_size;
+	};
+	const bvh_config configs[] =
+	{
+		{ "median", BVH_SPLIT_MEDIAN, 2 },
+		{ "sah", BVH_SPLIT_SAH, 1 },
+		{ "sah", BVH_SPLIT_SAH, 2 },
+		{ "sah", BVH_SPLIT_SAH, 4 },
+		{ "sah", BVH_SPLIT_SAH, 8 },
+	};
+
+	printf("suite,scene,objects,builder,max_leaf_size,layout,build_ms,sah_cost,seconds,rays_per_sec\n");
+	std::vector<worker_stats> stats;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	render_image(scene, lights, cam, settings, &fb, stats);
+	double seconds = seconds_since(start);
+	printf("bvh,%d,%d,list,0,list,0,%.2f,%.3f,%.0f\n", scene_num, scene->list_size, bvh_sah_cost(scene, 0, 1), seconds, total_rays(stats) / seconds);
+
+	for(size_t c = 0;
+		c < sizeof(configs)/sizeof(configs[0]);
+		c++)
+	{
+		// the median builder sorts the list it is given, so every builder gets its own copy
+		hitable **list = arena.make_array<hitable *>(scene->list_size);
+		memcpy(list, scene->list, scene->list_size*sizeof(hitable *));
+
+		start = std::chrono::steady_clock::now();
+		hitable *tree = build_bvh(arena, list, scene->list_size, 0, 1, configs[c].method, configs[c].max_leaf_size);
+		double build_ms = 1000.0*seconds_since(start);
+		start = std::chrono::steady_clock::now();
+		hitable *flat = arena.make<linear_bvh>(tree, 0, 1);
+		double flatten_ms = 1000.0*seconds_since(start);
+		start = std::chrono::steady_clock::now();
+		hitable *wide = arena.make<bvh4>(tree, 0, 1);
+		double collapse_ms = 1000.0*seconds_since(start);
+		float sah_cost = bvh_sah_cost(tree, 0, 1);
+
+		// the same tree traversed as linked bvh_nodes, as a flattened linear_bvh and collapsed into a bvh4
+		const char *layouts[3] = { "tree", "linear", "bvh4" };
+		hitable *worlds[3] = { tree, flat, wide };
+		double layout_build_ms[3] = { build_ms, build_ms + flatten_ms, build_ms + collapse_ms };
+		for(int l = 0;
+			l < 3;
+			l++)
+		{
+			start = std::chrono::steady_clock::now();
+			render_image(worlds[l], lights, cam, settings, &fb, stats);
+			seconds = seconds_since(start);
+			printf("bvh,%d,%d,%s,%d,%s,%.3f,%.2f,%.3f,%.0f\n", scene_num, scene->list_size, configs[c].name, configs[c].max_leaf_size, layouts[l], layout_build_ms[l], sah_cost, seconds, total_rays(stats) / seconds);
+		}
+	}
+}
+
+// aabb::hit as it was before rays cached their inverse direction: a division per axis per box and a branch to swap and to exit early
+bool aabb_hit_divide(const aabb& box, const ray& r, float t_min, float t_max)
+{
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		float inverse_dir = 1.0f / r.direction()[i];
+		float t0 = (box.min()[i] - r.origin()[i]) * inverse_dir;
+		float t1 = (box.max()[i] - r.origin()[i]) * inverse_dir;
+		if(inverse_dir < 0.0f)
+			std::swap(t0, t1);
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if(t_max <= t_min)
+			return false;
+	}
+	return true;
+}
+
+// tests every ray against every box in a fixed random set of boxes, both versions see exactly the same tests
+// the hit counts are printed so it is easy to see that both versions agree
+void bench_boxes(int ray_count)
+{
+	const int BOX_COUNT = 1024;
+	rng r;
+	r.seed(1, 1);
+	std::vector<aabb> boxes;
+	for(int i = 0;
+		i < BOX_COUNT;
+		i++)
+	{
+		point corner(20*r.next_float() - 10, 20*r.next_float() - 10, 20*r.next_float() - 10);
+		point size(2*r.next_float(), 2*r.next_float(), 2*r.next_float());
+		boxes.push_back(aabb(corner, corner + size));
+	}
+	std::vector<ray> rays;
+	for(int i = 0;
+		i < ray_count;
+		i++)
+	{
+		// rays start anywhere around the boxes and aim at a random point among them, so there is a mix of hits and misses
+		point origin(30*r.next_float() - 15, 30*r.next_float() - 15, 30*r.next_float() - 15);
+		point target(20*r.next_float() - 10, 20*r.next_float() - 10, 20*r.next_float() - 10);
+		rays.push_back(ray(origin, target - origin));
+	}
+
+	printf("suite,test,boxes_tested,hits,seconds,boxes_per_sec\n");
+	uint64_t tests = (uint64_t)ray_count*BOX_COUNT;
+	for(int version = 0;
+		version < 2;
+		version++)
+	{
+		uint64_t hits = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(int i = 0;
+			i < ray_count;
+			i++)
+		{
+			for(int b = 0;
+				b < BOX_COUNT;
+				b++)
+			{
+				if(version == 0)
+					hits += aabb_hit_divide(boxes[b], rays[i], 0.001f, FLT_MAX);
+				else
+					hits += boxes[b].hit(rays[i], 0.001f, FLT_MAX);
+			}
+		}
+		double seconds = seconds_since(start);
+		printf("boxes,%s,%llu,%llu,%.3f,%.0f\n", version == 0 ? "divide_per_test" : "cached_inverse", (unsigned long long)tests, (unsigned long long)hits, seconds, tests / seconds);
+	}
+}
+
+// box as it was before it had its own slab test: 6 rects (3 of them flipped) in a bvh
+class rect_box : public hitable
+{
+public:
+	rect_box(scene_arena& arena, const point& p0, const point& p1, material *mat_ptr)
+	{
+		p_min = p0;
+		p_max = p1;
+		hitable **list = arena.make_array<hitable *>(6);
+		list[0] = 							arena.make<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat_ptr);
+		list[1] = arena.make<flip_normals>(	arena.make<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat_ptr));
+		list[2] = 							arena.make<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat_ptr);
+		list[3] = arena.make<flip_normals>(	arena.make<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat_ptr));
+		list[4] = 							arena.make<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat_ptr);
+		list[5] = arena.make<flip_normals>(	arena.make<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat_ptr));
+		list_ptr = arena.make<bvh_node>(arena, list, 6, 0, 1);
+	}
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+	{
+		return list_ptr->hit(r, t_min, t_max, rec);
+	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return list_ptr->occluded(r, t_min, t_max);
+	}
+	virtual bool bounding_box(float t0, float t1, aabb& box) const
+	{
+		box = aabb(p_min, p_max);
+		return true;
+	}
+	point p_min, p_max;
+	hitable *list_ptr;
+};
+
+// renders the cornell box (scene 5) twice, once as it is and once with every box swapped for a rect_box
+// the boxes are inside instances, so the swap is done by pointing the instances at rect_boxes with the same corners
+void bench_cornell(int ns)
+{
+	scene_arena arena;
+	const int nx = 200;
+	const int ny = 200;
+	camera cam;
+	light_list lights;
+	hitable_list *scene = (hitable_list *)create_scene(5, arena, cam, lights, nx, ny, ACCEL_LIST, false);
+	hitable **rect_list = arena.make_array<hitable *>(scene->list_size);
+	int boxes = 0;
+	for(int i = 0;
+		i < scene->list_size;
+		i++)
+	{
+		rect_list[i] = scene->list[i];
+		instance *inst = dynamic_cast<instance *>(scene->list[i]);
+		const box *b = inst ? dynamic_cast<const box *>(inst->ptr) : NULL;
+		if(b)
+		{
+			rect_list[i] = arena.make<instance>(arena.make<rect_box>(arena, b->p_min, b->p_max, b->mat_ptr), inst->to_world);
+			boxes++;
+		}
+	}
+
+	const char *names[2] = { "slab_box", "rect_box" };
+	hitable *worlds[2] = { build_accel(arena, scene->list, scene->list_size, 0, 1, ACCEL_BVH), build_accel(arena, rect_list, scene->list_size, 0, 1, ACCEL_BVH) };
+	framebuffer fb(nx, ny);
+	render_settings settings;
+	settings.ns = ns;
+	std::vector<worker_stats> stats;
+	// the two are rendered in turn a few times and the fastest of each is kept, so one slow run doesn't decide the result
+	const int RUNS = 3;
+	double best_seconds[2] = { DBL_MAX, DBL_MAX };
+	uint64_t rays[2] = { 0, 0 };
+	for(int run = 0;
+		run < RUNS;
+		run++)
+	{
+		for(int w = 0;
+			w < 2;
+			w++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			render_image(worlds[w], lights, cam, settings, &fb, stats);
+			double seconds = seconds_since(start);
+			if(seconds < best_seconds[w])
+				best_seconds[w] = seconds;
+			rays[w] = total_rays(stats);
+		}
+	}
+	printf("suite,box,boxes,seconds,rays_per_sec\n");
+	for(int w = 0;
+		w < 2;
+		w++)
+	{
+		printf("cornell,%s,%d,%.3f,%.0f\n", names[w], boxes, best_seconds[w], rays[w] / best_seconds[w]);
+	}
+
+	// most of the cornell box's rays hit the walls, so the boxes on their own are also timed with rays from all around aimed at them
+	const int RAY_COUNT = 1000000;
+	rng r;
+	r.seed(1, 1);
+	std::vector<ray> test_rays;
+	for(int i = 0;
+		i < RAY_COUNT;
+		i++)
+	{
+		point origin(600*r.next_float() - 300, 600*r.next_float() - 300, 600*r.next_float() - 300);
+		point target(200*r.next_float() - 20, 200*r.next_float() - 20, 200*r.next_float() - 20);
+		test_rays.push_back(ray(origin, target - origin));
+	}
+	material *white = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.73, 0.73, 0.73)));
+	hitable *test_boxes[2] = { arena.make<box>(point(0,0,0), point(165,165,165), white), arena.make<rect_box>(arena, point(0,0,0), point(165,165,165), white) };
+	printf("suite,box,tests,hits,seconds,ns_per_test\n");
+	for(int w = 0;
+		w < 2;
+		w++)
+	{
+		uint64_t hits = 0;
+		hit_record rec;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(int i = 0;
+			i < RAY_COUNT;
+			i++)
+		{
+			hits += test_boxes[w]->hit(test_rays[i], 0.001f, FLT_MAX, rec);
+		}
+		double seconds = seconds_since(start);
+		printf("cornell_box_hit,%s,%d,%llu,%.3f,%.1f\n", names[w], RAY_COUNT, (unsigned long long)hits, seconds, 1e9 * seconds / RAY_COUNT);
+	}
+}
+
+// writes the positions, texture co-ordinates and faces of a mesh as a wavefront obj file
+bool write_obj(const triangle_mesh *mesh, const char *file_name)
+{
+	FILE *f = fopen(file_name, "wb");
+	if(!f)
+		return false;
+	for(size_t i = 0;
+		i < mesh->positions.size();
+		i++)
+	{
+		fprintf(f, "v %f %f %f\n", mesh->positions[i].x(), mesh->positions[i].y(), mesh->positions[i].z());
+	}
+	for(size_t i = 0;
+		i + 1 < mesh->uvs.size();
+		i += 2)
+	{
+		fprintf(f, "vt %f %f\n", mesh->uvs[i], mesh->uvs[i+1]);
+	}
+	for(int i = 0;
+		i < mesh->triangle_count();
+		i++)
+	{
+		const int32_t *p = &mesh->position_index[3*i];
+		if(mesh->uv_index.empty())
+		{
+			fprintf(f, "f %d %d %d\n", p[0]+1, p[1]+1, p[2]+1);
+		}
+		else
+		{
+			const int32_t *t = &mesh->uv_index[3*i];
+			fprintf(f, "f %d/%d %d/%d %d/%d\n", p[0]+1, t[0]+1, p[1]+1, t[1]+1, p[2]+1, t[2]+1);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+// generates a bumpy sphere with about triangle_count triangles, writes it out as an obj file and times reading it back,
+// building its bvh and rendering it in the mesh scene (see mesh_scene())
+void bench_mesh(int triangle_count, int ns)
+{
+	scene_arena arena;
+	const char *file_name = "bench_mesh.obj";
+	// rings*segments*2 triangles with twice as many segments as rings
+	int rings = (int)sqrt(triangle_count / 4.0);
+	if(rings < 2)
+		rings = 2;
+	material *grey = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.6, 0.6, 0.6)));
+	// the generated mesh is only needed until it has been written out, so it gets an arena of its own
+	scene_arena generated_arena;
+	triangle_mesh *generated = make_bumpy_sphere(generated_arena, rings, 2*rings, 1.0, grey);
+	if(!write_obj(generated, file_name))
+	{
+		printf("couldn't write %s\n", file_name);
+		return;
+	}
+	generated_arena.clear();
+
+	triangle_mesh *mesh = arena.make<triangle_mesh>(grey);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(!read_obj(file_name, mesh))
+		return;
+	double load_ms = 1000.0*seconds_since(start);
+	start = std::chrono::steady_clock::now();
+	mesh->build();
+	double build_ms = 1000.0*seconds_since(start);
+
+	const int nx = 200;
+	const int ny = 100;
+	camera cam;
+	light_list lights;
+	hitable *world = mesh_scene(arena, mesh, cam, lights, nx, ny, ACCEL_BVH, false);
+	framebuffer fb(nx, ny);
+	render_settings settings;
+	settings.ns = ns;
+	std::vector<worker_stats> stats;
+	start = std::chrono::steady_clock::now();
+	render_image(world, lights, cam, settings, &fb, stats);
+	double seconds = seconds_since(start);
+
+	printf("suite,triangles,vertices,nodes,load_ms,build_ms,seconds,rays_per_sec\n");
+	printf("mesh,%d,%d,%d,%.1f,%.1f,%.3f,%.0f\n", mesh->triangle_count(), (int)mesh->positions.size(), (int)mesh->nodes.size(), load_ms, build_ms, seconds, total_rays(stats) / seconds);
+	remove(file_name);
+}
+
+// builds every scene (except 3, which loads an image from a path relative to the build folder) repeats times in the same arena,
+// clearing it after each build, so the build time includes tearing the scene down again as a render server or animation would
+// bytes is what the arena handed out, the arrays inside meshes, sphere_sets and flattened bvhs are std::vectors on the heap (freed by clear() too)
+void bench_arena(int repeats)
+{
+	const int scenes[] = { 0, 1, 2, 4, 5, 6, 7, 8 };
+	printf("suite,scene,repeats,build_ms,bytes,objects_with_destructors\n");
+	scene_arena arena;
+	for(size_t s = 0;
+		s < sizeof(scenes)/sizeof(scenes[0]);
+		s++)
+	{
+		size_t bytes = 0;
+		int objects = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(int i = 0;
+			i < repeats;
+			i++)
+		{
+			camera cam;
+			light_list lights;
+			create_scene(scenes[s], arena, cam, lights, 200, 100);
+			bytes = arena.allocated_bytes();
+			objects = arena.object_count_with_destructors();
+			arena.clear();
+		}
+		double build_ms = 1000.0*seconds_since(start) / repeats;
+		printf("arena,%d,%d,%.3f,%llu,%d\n", scenes[s], repeats, build_ms, (unsigned long long)bytes, objects);
+	}
+}
+
+// makes count rays from random points 5 to 6 units from the origin, aimed at random points in a cube of half width target_size
+// around the origin, with random times for the moving objects
+// the kernels below are all about 1 unit in size at the origin, so a target_size of 0.5 gives rays that nearly all hit them
+// and a target_size of 4 gives rays that mostly go past
+std::vector<ray> make_kernel_rays(int count, float target_size, uint64_t seed)
+{
+	rng r;
+	r.seed(seed, 1);
+	std::vector<ray> rays;
+	for(int i = 0;
+		i < count;
+		i++)
+	{
+		point direction;
+		do
+		{
+			direction = point(2*r.next_float() - 1, 2*r.next_float() - 1, 2*r.next_float() - 1);
+		} while(direction.squared_length() > 1.0f || direction.squared_length() < 0.0001f);
+		point origin = (5 + r.next_float()) * unit_vector(direction);
+		point target(target_size*(2*r.next_float() - 1), target_size*(2*r.next_float() - 1), target_size*(2*r.next_float() - 1));
+		rays.push_back(ray(origin, target - origin, r.next_float()));
+	}
+	return rays;
+}
+
+// fires the same pre-made batches of rays at each primitive and wrapper on its own and reports the time per ray test
+// so changes to one hit() can be measured without the rest of the renderer around it
+// - every test is a full hit() call with a fresh hit_record, the way the bvh leaves call it (aabb is the bvh's own box test)
+// - each batch is run 3 times and the fastest is kept, which takes out most of the noise from other programs
+// - hit_fraction shows how hit or miss heavy the batch really was for that shape
+void bench_kernels(int ray_count)
+{
+	scene_arena arena;
+	material *white = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.73, 0.73, 0.73)));
+	material *smoke = arena.make<isotropic>(arena.make<constant_texture>(rgb(0.5, 0.5, 0.5)));
+
+	struct kernel
+	{
+		const char *name;
+		const hitable *object;	// NULL for the aabb test
+	};
+	hitable *unit_box = arena.make<box>(point(-1, -1, -1), point(1, 1, 1), white);
+	const kernel kernels[] =
+	{
+		{ "sphere", arena.make<sphere>(point(0, 0, 0), 1, white) },
+		{ "moving_sphere", arena.make<moving_sphere>(point(0, -0.5, 0), point(0, 0.5, 0), 0.0, 1.0, 1, white) },
+		{ "xy_rect", arena.make<xy_rect>(-1, 1, -1, 1, 0, white) },
+		{ "xz_rect", arena.make<xz_rect>(-1, 1, -1, 1, 0, white) },
+		{ "yz_rect", arena.make<yz_rect>(-1, 1, -1, 1, 0, white) },
+		{ "aabb", NULL },
+		{ "box", unit_box },
+		{ "rotate_y(box)", arena.make<rotate_y>(unit_box, 30) },
+		{ "instance(box)", arena.make<instance>(unit_box, mat4_rotation_y(30)) },
+		{ "constant_medium(sphere)", arena.make<constant_medium>(arena.make<sphere>(point(0, 0, 0), 1, white), 1.0, smoke) },
+	};
+	const aabb unit_aabb(point(-1, -1, -1), point(1, 1, 1));
+
+	struct batch
+	{
+		const char *name;
+		std::vector<ray> rays;
+	};
+	batch batches[2];
+	batches[0].name = "hit_heavy";
+	batches[0].rays = make_kernel_rays(ray_count, 0.5f, 1);
+	batches[1].name = "miss_heavy";
+	batches[1].rays = make_kernel_rays(ray_count, 4.0f, 2);
+
+	printf("suite,kernel,batch,tests,hit_fraction,seconds,ns_per_test\n");
+	for(size_t k = 0;
+		k < sizeof(kernels)/sizeof(kernels[0]);
+		k++)
+	{
+		for(int b = 0;
+			b < 2;
+			b++)
+		{
+			const std::vector<ray>& rays = batches[b].rays;
+			// the sum of the hit distances is printed so the compiler can't throw the tests away
+			uint64_t hits = 0;
+			double t_sum = 0;
+			double best_seconds = 0;
+			for(int run = 0;
+				run < 3;
+				run++)
+			{
+				// constant_medium draws random numbers, so every run starts from the same state
+				thread_rng().seed(0x853c49e6748fea9bULL, 0);
+				hits = 0;
+				t_sum = 0;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				for(size_t i = 0;
+					i < rays.size();
+					i++)
+				{
+					if(kernels[k].object)
+					{
+						hit_record rec;
+						if(kernels[k].object->hit(rays[i], 0.001f, FLT_MAX, rec))
+						{
+							hits++;
+							t_sum += rec.t;
+						}
+					}
+					else if(unit_aabb.hit(rays[i], 0.001f, FLT_MAX))
+					{
+						hits++;
+					}
+				}
+				double seconds = seconds_since(start);
+				if(run == 0 || seconds < best_seconds)
+					best_seconds = seconds;
+			}
+			printf("kernels,%s,%s,%llu,%.3f,%.4f,%.2f\n", kernels[k].name, batches[b].name, (unsigned long long)rays.size(),
+				   (double)hits / rays.size(), best_seconds, 1e9*best_seconds / rays.size());
+			if(t_sum < 0)
+				printf("# %f\n", t_sum);
+		}
+	}
+}
+
+// random_scene from in_one_weekend+multithreading/main.cpp, made of this renderer's objects so the two projects can be compared
+// the sphere grid, materials and camera are the same as there, the only differences are that colors are constant_textures and
+// the spheres go through finish_scene() like every other scene here (so they get a bvh instead of one hitable_list)
+hitable *in_one_weekend_random_scene(scene_arena& arena, camera& cam, light_list& lights, int total_nx, int total_ny)
+{
+	point lookfrom(6.0,2.0,1.5);
+	point lookat(0.0,0.0,-1.0);
+	float dist_to_focus = (lookfrom-lookat).length();
+	float aperture = 0.0;
+	cam = camera(lookfrom, lookat, point(0.5,0.5,0.0), 30, (float)total_nx/(float)total_ny, aperture, dist_to_focus, 0.0, 1.0);
+
+	int n = 500;
+	hitable **list = arena.make_array<hitable *>(n+1);
+	list[0] = arena.make<sphere>(point(0.0,-1000.0,0.0), 1000, arena.make<lambertian>(arena.make<constant_texture>(rgb(0.5,0.5,0.5))));
+	int i = 1;
+	for(int a = -11;
+		a < 11;
+		a++)
+	{
+		for(int b = -11;
+			b < 11;
+			b++)
+		{
+			float choose_mat = my_rand();
+			point center(a+0.9*my_rand(),0.2,b+0.9*my_rand());
+			if((center-point(4.0,0.2,0.0)).length() > 0.9)
+			{
+				if(choose_mat < 0.8)
+				{
+					rgb albedo(my_rand()*my_rand(), my_rand()*my_rand(), my_rand()*my_rand());
+					list[i++] = arena.make<sphere>(center, 0.2, arena.make<lambertian>(arena.make<constant_texture>(albedo)));
+				}
+				else if(choose_mat < 0.95)
+				{
+					list[i++] = arena.make<sphere>(center, 0.2, arena.make<metal>(rgb(0.5*(1+my_rand()), 0.5*(1+my_rand()), 0.5*(1+my_rand())), 0.5*my_rand()));
+				}
+				else
+				{
+					list[i++] = arena.make<sphere>(center, 0.2, arena.make<dielectric>(1.5));
+				}
+			}
+		}
+	}
+
+	list[i++] = arena.make<sphere>(point(0.0,1.0,0.0), 1.0, arena.make<dielectric>(1.5));
+	list[i++] = arena.make<sphere>(point(-4.0,1.0,0.0), 1.0, arena.make<lambertian>(arena.make<constant_texture>(rgb(0.4,0.2,0.1))));
+	list[i++] = arena.make<sphere>(point(4.0,1.0,0.0), 1.0, arena.make<metal>(rgb(0.7,0.6,0.5), 0.0));
+	return finish_scene(arena, list, i, lights, ACCEL_BVH, true);
+}
+
+// the random choices made while building a scene (e.g. scene 0's sphere grid) come from the main thread's generator
+// it is reset before every build so each scene is the same however many scenes were built before it
+void reset_scene_rng()
+{
+#ifdef LIBC_RAND
+	srand(1);
+#else
+	thread_rng() = rng();
+#endif
+}
+
+// renders every case of create_scene() and in_one_weekend's random_scene at a fixed size, sample count and seed,
+// with 1, 2, 4 ... up to max_threads threads
+// the csv has one line per scene and thread count:
+// - seconds is the wall time of the render, build_ms the time to build the scene
+// - primary/secondary/shadow rays per second are over the wall time (secondary rays are the ones made by scatter())
+// - thread_min/thread_max are the slowest and fastest single thread's rays per second over its own time, a big gap means the
+//   threads were waiting on something
+// - speedup is against the 1 thread run of the same scene
+void bench_scenes(int ns, int max_threads)
+{
+	const int nx = 200;
+	const int ny = 100;
+	// -1 is in_one_weekend's random_scene
+	const int scenes[] = { -1, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+	std::vector<int> thread_counts = benchmark_thread_counts(max_threads);
+
+	printf("suite,rng,scene,nx,ny,spp,threads,build_ms,seconds,primary_rays,secondary_rays,shadow_rays,primary_per_sec,secondary_per_sec,rays_per_sec,thread_min,thread_max,speedup\n");
+	for(size_t s = 0;
+		s < sizeof(scenes)/sizeof(scenes[0]);
+		s++)
+	{
+		int scene_num = scenes[s];
+		char scene_name[16];
+		if(scene_num < 0)
+			strcpy(scene_name, "weekend");
+		else
+			sprintf(scene_name, "%d", scene_num);
+		// scene 3's texture is found relative to the build directory (see create_scene())
+		if(scene_num == 3)
+		{
+			FILE *f = fopen("..\\assets\\earthmap.jpg", "rb");
+			if(!f)
+			{
+				printf("# skipping scene 3, ..\\assets\\earthmap.jpg isn't there\n");
+				continue;
+			}
+			fclose(f);
+		}
+
+		scene_arena arena;
+		camera cam;
+		light_list lights;
+		reset_scene_rng();
+		std::chrono::steady_clock::time_point build_start = std::chrono::steady_clock::now();
+		hitable *world;
+		if(scene_num < 0)
+			world = in_one_weekend_random_scene(arena, cam, lights, nx, ny);
+		else
+			world = create_scene(scene_num, arena, cam, lights, nx, ny);
+		double build_ms = 1000.0*seconds_since(build_start);
+
+		framebuffer fb(nx, ny);
+		render_settings settings;
+		settings.nx = nx;
+		settings.ny = ny;
+		settings.ns = ns;
+		double single_thread_rate = 0;
+		for(size_t run = 0;
+			run < thread_counts.size();
+			run++)
+		{
+			settings.thread_count = thread_counts[run];
+			std::vector<worker_stats> stats;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			render_image(world, lights, cam, settings, &fb, stats);
+			double seconds = seconds_since(start);
+
+			uint64_t primary = 0;
+			uint64_t secondary = 0;
+			uint64_t shadow = 0;
+			double thread_min = 0;
+			double thread_max = 0;
+			for(size_t i = 0;
+				i < stats.size();
+				i++)
+			{
+				primary += stats[i].primary_rays;
+				secondary += stats[i].secondary_rays;
+				shadow += stats[i].shadow_rays;
+				double thread_rate = stats[i].seconds > 0 ? (stats[i].primary_rays + stats[i].secondary_rays + stats[i].shadow_rays) / stats[i].seconds : 0;
+				if(i == 0 || thread_rate < thread_min)
+					thread_min = thread_rate;
+				if(i == 0 || thread_rate > thread_max)
+					thread_max = thread_rate;
+			}
+			double rate = (primary + secondary + shadow) / seconds;
+			if(run == 0)
+				single_thread_rate = rate;
+			printf("scenes,%s,%s,%d,%d,%d,%d,%.3f,%.3f,%llu,%llu,%llu,%.0f,%.0f,%.0f,%.0f,%.0f,%.2f\n",
+				   RNG_NAME, scene_name, nx, ny, ns, settings.thread_count, build_ms, seconds,
+				   (unsigned long long)primary, (unsigned long long)secondary, (unsigned long long)shadow,
+				   primary / seconds, secondary / seconds, rate, thread_min, thread_max, rate / single_thread_rate);
+			fflush(stdout);
+		}
+	}
+}
+
+// a lambertian sphere on a lambertian floor, all inside a big sphere light, so every shading point is inside the light
+// the light's pdf and random direction have to handle that case or the dome's light goes missing when light sampling is on
+hitable *inside_light_scene(scene_arena& arena, camera& cam, light_list& lights, int nx, int ny)
+{
+	cam = camera(point(0, 2, 8), point(0, 1, 0), point(0, 1, 0), 40, (float)nx/(float)ny, 0.0, 10.0, 0.0, 1.0);
+	hitable **list = arena.make_array<hitable *>(3);
+	list[0] = arena.make<sphere>(point(0, 0, 0), 100, arena.make<diffuse_light>(arena.make<constant_texture>(rgb(1, 1, 1))));
+	list[1] = arena.make<sphere>(point(0, 1, 0), 1, arena.make<lambertian>(arena.make<constant_texture>(rgb(0.5, 0.5, 0.5))));
+	list[2] = arena.make<xz_rect>(-10, 10, -10, 10, 0, arena.make<lambertian>(arena.make<constant_texture>(rgb(0.3, 0.3, 0.3))));
+	return finish_scene(arena, list, 3, lights, ACCEL_BVH, true);
+}
+
+// the average of every channel of every pixel
+double mean_pixel(const framebuffer& fb)
+{
+	double sum = 0;
+	for(int j = 0;
+		j < fb.height;
+		j++)
+	{
+		for(int i = 0;
+			i < fb.width;
+			i++)
+		{
+			rgb c = fb.get(i, j);
+			sum += c[0] + c[1] + c[2];
+		}
+	}
+	return sum / (3.0*fb.width*fb.height);
+}
+
+// light sampling (next event estimation with mis) only changes the noise of a render, not how bright it is on average
+// so each scene is rendered with it off and on and the mean pixels are compared, a difference above the tolerance means
+// some light's pdf_value()/random() are wrong for the points it is lit from
+// returns false if any scene failed
+bool bench_lights(int ns)
+{
+	const int nx = 100;
+	const int ny = 100;
+	const double TOLERANCE = 0.05;
+	// -1 is inside_light_scene()
+	const int scenes[] = { -1, 5 };
+
+	bool passed = true;
+	printf("suite,scene,spp,mean_without,mean_with,difference,result\n");
+	for(size_t s = 0;
+		s < sizeof(scenes)/sizeof(scenes[0]);
+		s++)
+	{
+		int scene_num = scenes[s];
+		scene_arena arena;
+		camera cam;
+		light_list lights;
+		hitable *world;
+		if(scene_num < 0)
+			world = inside_light_scene(arena, cam, lights, nx, ny);
+		else
+			world = create_scene(scene_num, arena, cam, lights, nx, ny);
+
+		framebuffer fb(nx, ny);
+		render_settings settings;
+		settings.nx = nx;
+		settings.ny = ny;
+		settings.ns = ns;
+		std::vector<worker_stats> stats;
+		double means[2];
+		for(int with = 0;
+			with < 2;
+			with++)
+		{
+			settings.light_sampling = with != 0;
+			render_image(world, lights, cam, settings, &fb, stats);
+			means[with] = mean_pixel(fb);
+		}
+		double difference = means[0] > 0 ? fabs(means[1] - means[0]) / means[0] : fabs(means[1]);
+		bool ok = difference <= TOLERANCE;
+		passed = passed && ok;
+		printf("lights,%s,%d,%.4f,%.4f,%.4f,%s\n", scene_num < 0 ? "inside_light" : "5", ns, means[0], means[1], difference, ok ? "ok" : "FAIL");
+		fflush(stdout);
+	}
+	return passed;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc < 2)
+	{
+		printf("usage: bench <suite> [arguments]\n");
+		printf("  threads [scene] [samples]\n");
+		printf("  bvh [scene] [samples]\n");
+		printf("  boxes [rays]\n");
+		printf("  mesh [triangles] [samples]\n");
+		printf("  cornell [samples]\n");
+		printf("  arena [repeats]\n");
+		printf("  kernels [rays]\n");
+		printf("  scenes [samples] [threads]\n");
+		printf("  lights [samples]\n");
+		return 1;
+	}
+
+	if(strcmp(argv[1], "threads") == 0)
+	{
+		int scene_num = argc > 2 ? atoi(argv[2]) : 0;
+		int ns = argc > 3 ? atoi(argv[3]) : 16;
+		bench_threads(scene_num, ns);
+	}
+	else if(strcmp(argv[1], "bvh") == 0)
+	{
+		int scene_num = argc > 2 ? atoi(argv[2]) : 0;
+		int ns = argc > 3 ? atoi(argv[3]) : 16;
+		bench_bvh(scene_num, ns);
+	}
+	else if(strcmp(argv[1], "boxes") == 0)
+	{
+		int ray_count = argc > 2 ? atoi(argv[2]) : 20000;
+		bench_boxes(ray_count);
+	}
+	else if(strcmp(argv[1], "mesh") == 0)
+	{
+		int triangle_count = argc > 2 ? atoi(argv[2]) : 1000000;
+		int ns = argc > 3 ? atoi(argv[3]) : 4;
+		bench_mesh(triangle_count, ns);
+	}
+	else if(strcmp(argv[1], "cornell") == 0)
+	{
+		int ns = argc > 2 ? atoi(argv[2]) : 16;
+		bench_cornell(ns);
+	}
+	else if(strcmp(argv[1], "arena") == 0)
+	{
+		int repeats = argc > 2 ? atoi(argv[2]) : 10;
+		bench_arena(repeats);
+	}
+	else if(strcmp(argv[1], "kernels") == 0)
+	{
+		int ray_count = argc > 2 ? atoi(argv[2]) : 1000000;
+		bench_kernels(ray_count);
+	}
+	else if(strcmp(argv[1], "scenes") == 0)
+	{
+		int ns = argc > 2 ? atoi(argv[2]) : 16;
+		int max_threads = argc > 3 ? atoi(argv[3]) : default_thread_count();
+		bench_scenes(ns, max_threads < 1 ? 1 : max_threads);
+	}
+	else if(strcmp(argv[1], "lights") == 0)
+	{
+		int ns = argc > 2 ? atoi(argv[2]) : 64;
+		if(!bench_lights(ns))
+			return 1;
+	}
+	else
+	{
+		printf("unknown suite: %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
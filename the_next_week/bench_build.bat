@@ -0,0 +1,10 @@
+@echo off
+
+call "C:\VisualStudio\VC\Auxiliary\Build\vcvarsall.bat" x64
+
+IF NOT EXIST .\build mkdir .\build
+pushd .\build
+cl -MT -O2 -arch:AVX2 -wd4477 -wd4530 ..\bench.cpp
+REM same benchmark using the old rand() based my_rand(), for comparison
+cl -MT -O2 -arch:AVX2 -wd4477 -wd4530 -DLIBC_RAND -Febench_libc_rand.exe ..\bench.cpp
+popd .\build
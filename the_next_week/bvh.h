@@ -0,0 +1,1068 @@
+#ifndef BVHH
+#define BVHH
+
+#include "hitable.h"
+#include "trace.h"
+#include <float.h>
+#include <algorithm>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+// the bvh_node constructor in hitable.h sorts on a random axis and splits the objects in half
+// that is cheap to build but gives poor trees when objects are clustered (e.g. lots of small spheres next to one huge ground sphere)
+// this file adds a builder that uses the 'surface area heuristic' (SAH) to pick splits instead
+// ----
+// the SAH estimates the cost of tracing a ray through a node:
+// cost = TRAVERSAL_COST + (SA(left)/SA(node))*N(left)*INTERSECT_COST + (SA(right)/SA(node))*N(right)*INTERSECT_COST
+// where SA() is surface area and N() is the number of objects
+// SA(child)/SA(node) is the probability that a ray that hits the node also hits the child's box
+// so the best split is the one that puts lots of objects into small boxes
+// ----
+// rather than trying every possible split, the objects' centroids are dropped into a fixed number of 'bins' along each axis
+// and only the splits between bins are evaluated, this makes building O(n log n) and the trees are almost as good
+
+enum bvh_split_method
+{
+	BVH_SPLIT_MEDIAN,	// the original random axis, split in half bvh_node constructor
+	BVH_SPLIT_SAH,		// binned surface area heuristic
+};
+
+// cost constants for the SAH, only their ratio matters
+const float BVH_TRAVERSAL_COST = 1.0f;
+const float BVH_INTERSECT_COST = 1.0f;
+const int BVH_SAH_BINS = 16;
+
+// the traversal loops keep the nodes they still have to visit on a fixed size stack, so no tree can be deeper than BVH_MAX_DEPTH levels
+// the SAH can make very deep trees from skewed input (e.g. objects spaced exponentially along a line, where every split just cuts
+// the last object off), so below BVH_SAH_MAX_DEPTH levels the builders split in half instead
+// halving adds at most 31 more levels (n is an int), which keeps every tree within BVH_MAX_DEPTH
+const int BVH_MAX_DEPTH = 64;
+const int BVH_SAH_MAX_DEPTH = 32;
+
+// the builders work on these instead of calling bounding_box() on the objects over and over
+struct bvh_build_prim
+{
+	aabb box;
+	point centroid;
+	int index;		// index into whatever array of objects the boxes came from
+};
+
+// splits prims in half at the median of their centroids along the axis the centroids are most spread out on
+// returns the number of prims that went to the left side, or 0 if n is small enough to be a leaf
+int bvh_median_partition(bvh_build_prim *prims, int n, int max_leaf_size)
+{
+	if(n <= max_leaf_size)
+		return 0;
+	aabb centroid_bounds(prims[0].centroid, prims[0].centroid);
+	for(int i = 1;
+		i < n;
+		i++)
+	{
+		centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+	}
+	point extent = centroid_bounds.max() - centroid_bounds.min();
+	int axis = 0;
+	for(int i = 1;
+		i < 3;
+		i++)
+	{
+		if(extent[i] > extent[axis])
+			axis = i;
+	}
+	std::nth_element(prims, prims + n/2, prims + n, [=](const bvh_build_prim& a, const bvh_build_prim& b)
+	{
+		return a.centroid[axis] < b.centroid[axis];
+	});
+	return n/2;
+}
+
+// picks the cheapest split of prims according to the SAH and partitions prims so the left side comes first
+// returns the number of prims that went to the left side, or 0 if not splitting (making a leaf) is cheaper
+// if n > max_leaf_size a split is always made, when the SAH can't separate the prims (e.g. they all have the same centroid) they are split in half
+// depth is how many levels of the tree are above the node being split, from BVH_SAH_MAX_DEPTH on it always splits in half
+int bvh_sah_partition(bvh_build_prim *prims, int n, int max_leaf_size, int depth = 0)
+{
+	if(depth >= BVH_SAH_MAX_DEPTH)
+		return bvh_median_partition(prims, n, max_leaf_size);
+
+	aabb bounds = prims[0].box;
+	aabb centroid_bounds(prims[0].centroid, prims[0].centroid);
+	for(int i = 1;
+		i < n;
+		i++)
+	{
+		bounds = surrounding_box(bounds, prims[i].box);
+		centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+	}
+
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_bin = 0;
+	for(int axis = 0;
+		axis < 3;
+		axis++)
+	{
+		float axis_min = centroid_bounds.min()[axis];
+		float extent = centroid_bounds.max()[axis] - axis_min;
+		if(extent <= 0.0f)
+			continue;  // all centroids are on the same plane, nothing to split on this axis
+
+		int bin_count[BVH_SAH_BINS] = {};
+		aabb bin_box[BVH_SAH_BINS];
+		for(int i = 0;
+			i < n;
+			i++)
+		{
+			int b = (int)(BVH_SAH_BINS * (prims[i].centroid[axis] - axis_min) / extent);
+			if(b > BVH_SAH_BINS-1) b = BVH_SAH_BINS-1;
+			bin_box[b] = bin_count[b] ? surrounding_box(bin_box[b], prims[i].box) : prims[i].box;
+			bin_count[b]++;
+		}
+
+		// sweep from the right to get the area and count of everything to the right of each split
+		float right_area[BVH_SAH_BINS];
+		int right_count[BVH_SAH_BINS];
+		aabb acc;
+		int count = 0;
+		for(int b = BVH_SAH_BINS-1;
+			b > 0;
+			b--)
+		{
+			if(bin_count[b])
+			{
+				acc = count ? surrounding_box(acc, bin_box[b]) : bin_box[b];
+				count += bin_count[b];
+			}
+			right_count[b] = count;
+			right_area[b] = count ? acc.surface_area() : 0.0f;
+		}
+
+		// then sweep from the left, split 'b' means bins [0,b) go left and [b,BINS) go right
+		count = 0;
+		for(int b = 1;
+			b < BVH_SAH_BINS;
+			b++)
+		{
+			if(bin_count[b-1])
+			{
+				acc = count ? surrounding_box(acc, bin_box[b-1]) : bin_box[b-1];
+				count += bin_count[b-1];
+			}
+			if(count == 0 || right_count[b] == 0)
+				continue;
+			float cost = count*acc.surface_area() + right_count[b]*right_area[b];
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = b;
+			}
+		}
+	}
+
+	float parent_area = bounds.surface_area();
+	if(best_axis != -1 && parent_area > 0.0f)
+		best_cost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST*best_cost/parent_area;
+	float leaf_cost = BVH_INTERSECT_COST*n;
+
+	if(n <= max_leaf_size && (best_axis == -1 || leaf_cost <= best_cost))
+		return 0;
+
+	if(best_axis == -1)
+	{
+		// no usable split, the prims are all piled on top of each other
+		return n/2;
+	}
+
+	float axis_min = centroid_bounds.min()[best_axis];
+	float extent = centroid_bounds.max()[best_axis] - axis_min;
+	bvh_build_prim *mid = std::partition(prims, prims+n, [=](const bvh_build_prim& p)
+	{
+		int b = (int)(BVH_SAH_BINS * (p.centroid[best_axis] - axis_min) / extent);
+		if(b > BVH_SAH_BINS-1) b = BVH_SAH_BINS-1;
+		return b < best_bin;
+	});
+	return (int)(mid - prims);
+}
+
+// builds the tree for prims, list is the array that prims[i].index points into
+// leaves with one object are the object itself, leaves with more than one are a hitable_list
+hitable *bvh_build_sah(scene_arena& arena, bvh_build_prim *prims, int n, hitable **list, float time0, float time1, int max_leaf_size, int depth = 0)
+{
+	int left_count = bvh_sah_partition(prims, n, max_leaf_size, depth);
+	if(left_count == 0)
+	{
+		if(n == 1)
+			return list[prims[0].index];
+		hitable **leaf = arena.make_array<hitable *>(n);
+		for(int i = 0;
+			i < n;
+			i++)
+		{
+			leaf[i] = list[prims[i].index];
+		}
+		return arena.make<hitable_list>(leaf, n);
+	}
+
+	hitable *left = bvh_build_sah(arena, prims, left_count, list, time0, time1, max_leaf_size, depth+1);
+	hitable *right = bvh_build_sah(arena, prims+left_count, n-left_count, list, time0, time1, max_leaf_size, depth+1);
+	aabb box_left, box_right;
+	left->bounding_box(time0, time1, box_left);
+	right->bounding_box(time0, time1, box_right);
+	return arena.make<bvh_node>(left, right, surrounding_box(box_left, box_right));
+}
+
+// builds a bvh over list using the given split method
+// max_leaf_size is only used by the SAH builder (the median builder always goes down to 1 or 2 objects per leaf)
+// every object in list must have a bounding box
+hitable *build_bvh(scene_arena& arena, hitable **list, int n, float time0, float time1, bvh_split_method method, int max_leaf_size=4)
+{
+	TRACE_SCOPE("build_bvh");
+	assert(n > 0);
+	if(method == BVH_SPLIT_MEDIAN)
+		return arena.make<bvh_node>(arena, list, n, time0, time1);
+
+	bvh_build_prim *prims = new bvh_build_prim[n];
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		if(!list[i]->bounding_box(time0, time1, prims[i].box))
+			std::cerr << "no bounding box in build_bvh\n";
+		prims[i].centroid = 0.5f*(prims[i].box.min() + prims[i].box.max());
+		prims[i].index = i;
+	}
+	hitable *root = bvh_build_sah(arena, prims, n, list, time0, time1, max_leaf_size);
+	delete[] prims;
+	return root;
+}
+
+// the SAH cost of a tree, this is the expected cost (in units of object intersection tests) of tracing a ray that hits the root box
+// lower is better, it is useful for comparing builders without having to render anything
+float bvh_sah_cost(const hitable *node, float time0, float time1)
+{
+	if(const bvh_node *inner = dynamic_cast<const bvh_node *>(node))
+	{
+		aabb left_box, right_box;
+		inner->left->bounding_box(time0, time1, left_box);
+		inner->right->bounding_box(time0, time1, right_box);
+		float area = inner->box.surface_area();
+		if(area <= 0.0f)
+			area = 1.0f;
+		float cost = BVH_TRAVERSAL_COST + (left_box.surface_area()/area)*bvh_sah_cost(inner->left, time0, time1);
+		// the median builder points both sides at the same object when there is only one, it only gets tested once
+		if(inner->right != inner->left)
+			cost += (right_box.surface_area()/area)*bvh_sah_cost(inner->right, time0, time1);
+		return cost;
+	}
+	if(const hitable_list *leaf = dynamic_cast<const hitable_list *>(node))
+		return BVH_INTERSECT_COST*leaf->list_size;
+	return BVH_INTERSECT_COST;
+}
+
+// the flattened layouts below (linear_bvh, bvh4) are made from the trees the builders output
+// returns node as a bvh_node if it is an inner node with two different children, NULL if it should become a leaf
+const bvh_node *bvh_inner_node(const hitable *node)
+{
+	const bvh_node *inner = dynamic_cast<const bvh_node *>(node);
+	if(inner && inner->left != inner->right)
+		return inner;
+	return NULL;
+}
+
+// adds the objects of a leaf of the tree to prims
+// hitable_lists are leaves holding their objects, a bvh_node with both sides pointing at the same object holds that object
+// anything else is a leaf with one object
+void bvh_append_leaf(const hitable *node, std::vector<hitable *>& prims)
+{
+	if(const bvh_node *single = dynamic_cast<const bvh_node *>(node))
+	{
+		prims.push_back(single->left);
+	}
+	else if(const hitable_list *leaf = dynamic_cast<const hitable_list *>(node))
+	{
+		for(int i = 0;
+			i < leaf->list_size;
+			i++)
+		{
+			prims.push_back(leaf->list[i]);
+		}
+	}
+	else
+	{
+		prims.push_back(const_cast<hitable *>(node));
+	}
+}
+
+// a bvh stored as one contiguous array of nodes in depth first order, instead of a tree of heap allocated bvh_nodes
+// the first child of an inner node is always the next node in the array, so only the offset of the second child is stored
+// ----
+// this is faster to traverse than bvh_node because:
+//   -nodes are 32 bytes so two fit in a cache line, and a depth first walk reads the array mostly forwards
+//   -the box test is done inline instead of through a virtual call for every node
+//   -traversal is a loop with a small stack instead of recursion
+//   -the child that is closer to the ray origin is visited first, and any node whose box starts beyond the closest hit found so far is skipped
+struct linear_bvh_node
+{
+	float box_min[3];
+	float box_max[3];
+	// inner nodes: index of the second child
+	// leaves: index of the first object in linear_bvh::prims
+	int32_t offset;
+	uint16_t prim_count;	// 0 for inner nodes
+	uint8_t axis;			// the axis the children are split along, used to decide which child to visit first
+	uint8_t pad;
+};
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be 32 bytes so two fit in a cache line");
+static_assert(offsetof(linear_bvh_node, box_max) == 3*sizeof(float), "linear_bvh_planes() relies on box_max following box_min");
+
+// box_min followed by box_max, so plane 3*side + axis is the min (side 0) or max (side 1) plane on that axis
+inline const float *linear_bvh_planes(const linear_bvh_node& node)
+{
+	return node.box_min;
+}
+
+class linear_bvh : public hitable
+{
+public:
+	// flattens a tree made by bvh_node's constructor or build_bvh()
+	// hitable_lists inside the tree become leaves holding their objects, anything else that isn't a bvh_node is a leaf with one object
+	linear_bvh(const hitable *root, float time0, float time1);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const
+	{
+		b = box;
+		return true;
+	}
+
+	std::vector<linear_bvh_node> nodes;
+	std::vector<hitable *> prims;
+	aabb box;
+	int depth;		// levels of nodes on the longest path from the root to a leaf
+
+private:
+	int flatten(const hitable *node, float time0, float time1, int level);
+	int add_node(const aabb& node_box);
+};
+
+linear_bvh::linear_bvh(const hitable *root, float time0, float time1) : depth(0)
+{
+	TRACE_SCOPE("flatten to linear_bvh");
+	root->bounding_box(time0, time1, box);
+	flatten(root, time0, time1, 1);
+	// the builders keep their trees within BVH_MAX_DEPTH, a deeper tree can't be traversed
+	assert(depth <= BVH_MAX_DEPTH);
+}
+
+int linear_bvh::add_node(const aabb& node_box)
+{
+	linear_bvh_node node;
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		node.box_min[i] = node_box.min()[i];
+		node.box_max[i] = node_box.max()[i];
+	}
+	node.offset = 0;
+	node.prim_count = 0;
+	node.axis = 0;
+	node.pad = 0;
+	nodes.push_back(node);
+	return (int)nodes.size()-1;
+}
+
+// returns the index of the node that was created for 'node', level is 1 for the root
+int linear_bvh::flatten(const hitable *node, float time0, float time1, int level)
+{
+	aabb node_box;
+	node->bounding_box(time0, time1, node_box);
+	int index = add_node(node_box);
+	if(level > depth)
+		depth = level;
+
+	if(const bvh_node *inner = bvh_inner_node(node))
+	{
+		// the split axis isn't stored in bvh_node, use the axis the children's centers are furthest apart on
+		aabb left_box, right_box;
+		inner->left->bounding_box(time0, time1, left_box);
+		inner->right->bounding_box(time0, time1, right_box);
+		point separation = (left_box.min() + left_box.max()) - (right_box.min() + right_box.max());
+		int axis = 0;
+		for(int i = 1;
+			i < 3;
+			i++)
+		{
+			if(fabs(separation[i]) > fabs(separation[axis]))
+				axis = i;
+		}
+		// the child on the low side of the axis is always stored first, so traversal only has to look at the sign of the ray direction
+		const hitable *low = inner->left;
+		const hitable *high = inner->right;
+		if(separation[axis] > 0)
+			std::swap(low, high);
+		flatten(low, time0, time1, level+1);
+		int second = flatten(high, time0, time1, level+1);
+		// nodes may have been reallocated by the recursive calls, so index again instead of holding a reference
+		nodes[index].offset = second;
+		nodes[index].axis = (uint8_t)axis;
+		return index;
+	}
+
+	// leaf
+	nodes[index].offset = (int32_t)prims.size();
+	bvh_append_leaf(node, prims);
+	assert(prims.size() - nodes[index].offset <= 0xFFFF);
+	nodes[index].prim_count = (uint16_t)(prims.size() - nodes[index].offset);
+	return index;
+}
+
+// the traversal loops for an array of linear_bvh_nodes, shared by linear_bvh and triangle_mesh (mesh.h) which only differ in what their leaves hold
+// test_leaf(first, count, closest_so_far) tests the leaf's objects first to first+count-1 and returns true if any of them is hit closer than closest_so_far,
+// in which case it also lowers closest_so_far to the new closest hit
+template<typename leaf_function>
+bool linear_bvh_closest_hit(const linear_bvh_node *nodes, const ray& r, float t_min, float t_max, leaf_function test_leaf)
+{
+	// these are the same for every box the ray is tested against, the ray works out the inverse and sign when it is made
+	float inverse_dir[3];
+	float origin[3];
+	bool dir_negative[3];
+	int sign[3];
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		inverse_dir[i] = r.inverse_direction()[i];
+		origin[i] = r.origin()[i];
+		sign[i] = r.sign(i);
+		dir_negative[i] = sign[i] != 0;
+	}
+
+	// every inner node on the way down to a leaf pushes one child, so a tree of BVH_MAX_DEPTH levels needs less than BVH_MAX_DEPTH
+	const int STACK_SIZE = BVH_MAX_DEPTH;
+	int stack[STACK_SIZE];
+	int stack_top = 0;
+	int current = 0;
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+	for(;;)
+	{
+		const linear_bvh_node& node = nodes[current];
+		RT_STAT(bvh_nodes_visited);
+		RT_STAT(box_tests);
+		// same slab test as aabb::hit, but the far end of the ray is the closest hit so far
+		// like aabb::hit the ray's sign picks the entry and exit planes, so there is no swap to mispredict
+		float node_t_min = t_min;
+		float node_t_max = closest_so_far;
+		const float *planes = linear_bvh_planes(node);
+		for(int i = 0;
+			i < 3;
+			i++)
+		{
+			float t0 = (planes[3*sign[i] + i] - origin[i]) * inverse_dir[i];
+			float t1 = (planes[3*(1-sign[i]) + i] - origin[i]) * inverse_dir[i];
+			node_t_min = t0 > node_t_min ? t0 : node_t_min;
+			node_t_max = t1 < node_t_max ? t1 : node_t_max;
+		}
+
+		if(node_t_max > node_t_min)
+		{
+			if(node.prim_count > 0)
+			{
+				// leaf, objects only write to rec when they find something closer than closest_so_far
+				if(test_leaf(node.offset, node.prim_count, closest_so_far))
+					hit_anything = true;
+			}
+			else
+			{
+				// visit the child on the near side of the split first, the far child waits on the stack
+				// by the time it is popped closest_so_far may have shrunk enough that its box test fails
+				assert(stack_top < STACK_SIZE);
+				if(dir_negative[node.axis])
+				{
+					stack[stack_top++] = current+1;
+					current = node.offset;
+				}
+				else
+				{
+					stack[stack_top++] = node.offset;
+					current = current+1;
+				}
+				continue;
+			}
+		}
+
+		if(stack_top == 0)
+			break;
+		current = stack[--stack_top];
+	}
+	return hit_anything;
+}
+
+// same walk as linear_bvh_closest_hit except it returns as soon as anything is hit
+// the order children are visited in doesn't matter here, any hit will do
+// test_leaf(first, count) returns true if any of the leaf's objects blocks the ray
+template<typename leaf_function>
+bool linear_bvh_any_hit(const linear_bvh_node *nodes, const ray& r, float t_min, float t_max, leaf_function test_leaf)
+{
+	float inverse_dir[3];
+	float origin[3];
+	int sign[3];
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		inverse_dir[i] = r.inverse_direction()[i];
+		origin[i] = r.origin()[i];
+		sign[i] = r.sign(i);
+	}
+
+	// every inner node on the way down to a leaf pushes one child, so a tree of BVH_MAX_DEPTH levels needs less than BVH_MAX_DEPTH
+	const int STACK_SIZE = BVH_MAX_DEPTH;
+	int stack[STACK_SIZE];
+	int stack_top = 0;
+	int current = 0;
+	for(;;)
+	{
+		const linear_bvh_node& node = nodes[current];
+		RT_STAT(bvh_nodes_visited);
+		RT_STAT(box_tests);
+		float node_t_min = t_min;
+		float node_t_max = t_max;
+		const float *planes = linear_bvh_planes(node);
+		for(int i = 0;
+			i < 3;
+			i++)
+		{
+			float t0 = (planes[3*sign[i] + i] - origin[i]) * inverse_dir[i];
+			float t1 = (planes[3*(1-sign[i]) + i] - origin[i]) * inverse_dir[i];
+			node_t_min = t0 > node_t_min ? t0 : node_t_min;
+			node_t_max = t1 < node_t_max ? t1 : node_t_max;
+		}
+
+		if(node_t_max > node_t_min)
+		{
+			if(node.prim_count > 0)
+			{
+				if(test_leaf(node.offset, node.prim_count))
+					return true;
+			}
+			else
+			{
+				assert(stack_top < STACK_SIZE);
+				stack[stack_top++] = node.offset;
+				current = current+1;
+				continue;
+			}
+		}
+
+		if(stack_top == 0)
+			break;
+		current = stack[--stack_top];
+	}
+	return false;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	return linear_bvh_closest_hit(&nodes[0], r, t_min, t_max, [&](int first, int count, float& closest_so_far)
+	{
+		bool hit_anything = false;
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			if(prims[i]->hit(r, t_min, closest_so_far, rec))
+			{
+				hit_anything = true;
+				closest_so_far = rec.t;
+			}
+		}
+		return hit_anything;
+	});
+}
+
+bool linear_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+	return linear_bvh_any_hit(&nodes[0], r, t_min, t_max, [&](int first, int count)
+	{
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			if(prims[i]->occluded(r, t_min, t_max))
+				return true;
+		}
+		return false;
+	});
+}
+
+// builds linear_bvh_nodes straight from prims with the SAH, for objects that keep their own primitives in an array (triangle_mesh, instance_bvh)
+// instead of a hitable per primitive: prims are the primitives that will end up at first to first+n-1, and are reordered so every leaf's
+// primitives are next to each other, the caller then puts its own primitives in the same order as prims
+// nodes are laid out the same as in linear_bvh: depth first, the first child right after its parent and the child on the low side of the split first
+// depth is the number of levels above this node, like bvh_build_sah() it splits in half from BVH_SAH_MAX_DEPTH on so the tree stays within BVH_MAX_DEPTH
+// returns the index of the node
+int linear_bvh_build(std::vector<linear_bvh_node>& nodes, bvh_build_prim *prims, int n, int first, int max_leaf_size, int depth = 0)
+{
+	aabb node_box = prims[0].box;
+	for(int i = 1;
+		i < n;
+		i++)
+	{
+		node_box = surrounding_box(node_box, prims[i].box);
+	}
+	linear_bvh_node node;
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		node.box_min[i] = node_box.min()[i];
+		node.box_max[i] = node_box.max()[i];
+	}
+	node.offset = first;
+	node.prim_count = 0;
+	node.axis = 0;
+	node.pad = 0;
+	int index = (int)nodes.size();
+	nodes.push_back(node);
+
+	int left_count = bvh_sah_partition(prims, n, max_leaf_size, depth);
+	if(left_count == 0)
+	{
+		nodes[index].prim_count = (uint16_t)n;
+		return index;
+	}
+
+	// same choice of axis as linear_bvh::flatten, the axis the two halves' centers are furthest apart on
+	aabb left_box = prims[0].box;
+	aabb right_box = prims[left_count].box;
+	for(int i = 1;
+		i < n;
+		i++)
+	{
+		if(i < left_count)
+			left_box = surrounding_box(left_box, prims[i].box);
+		else if(i > left_count)
+			right_box = surrounding_box(right_box, prims[i].box);
+	}
+	point separation = (left_box.min() + left_box.max()) - (right_box.min() + right_box.max());
+	int axis = 0;
+	for(int i = 1;
+		i < 3;
+		i++)
+	{
+		if(fabs(separation[i]) > fabs(separation[axis]))
+			axis = i;
+	}
+	if(separation[axis] > 0)
+	{
+		// the right half is on the low side, swap the halves so it comes first
+		std::rotate(prims, prims + left_count, prims + n);
+		left_count = n - left_count;
+	}
+	linear_bvh_build(nodes, prims, left_count, first, max_leaf_size, depth+1);
+	int second = linear_bvh_build(nodes, prims + left_count, n - left_count, first + left_count, max_leaf_size, depth+1);
+	nodes[index].offset = second;
+	nodes[index].axis = (uint8_t)axis;
+	return index;
+}
+
+// checks the subtree starting at nodes[index] is laid out the way linear_bvh_build() lays trees out, level is 1 for the root
+// returns the index one past the end of the subtree, or -1 if it is broken
+int linear_bvh_check(const linear_bvh_node *nodes, int node_count, int prim_count, int index, int level)
+{
+	if(index >= node_count || level > BVH_MAX_DEPTH)
+		return -1;
+	const linear_bvh_node& node = nodes[index];
+	if(node.prim_count > 0)
+		return (node.offset >= 0 && node.offset <= prim_count - node.prim_count) ? index+1 : -1;
+	if(node.axis > 2)
+		return -1;
+	// the first child's subtree has to end right where the second child starts
+	int first_end = linear_bvh_check(nodes, node_count, prim_count, index+1, level+1);
+	if(first_end < 0 || first_end != node.offset)
+		return -1;
+	return linear_bvh_check(nodes, node_count, prim_count, node.offset, level+1);
+}
+
+// for nodes that weren't built here (a compiled scene file's meshes): true if they make one tree of every node, no deeper than
+// BVH_MAX_DEPTH, whose leaves only refer to primitives 0 to prim_count-1, so the traversal loops can't read outside either array
+bool linear_bvh_valid(const linear_bvh_node *nodes, int node_count, int prim_count)
+{
+	return node_count > 0 && linear_bvh_check(nodes, node_count, prim_count, 0, 1) == node_count;
+}
+
+// a bvh where every node has up to 4 children, made by collapsing the binary tree the builders output
+// the 4 child boxes are stored 'structure of arrays' (all of the min x's together, etc.) so one SSE slab test checks a ray against all of them
+// ----
+// compared to linear_bvh this halves the depth of the tree, so a ray visits about half as many nodes
+// and each visit does 4 box tests in about the time of one scalar box test
+// children that are hit are visited nearest first, and skipped if the closest hit found so far is nearer than their box
+struct bvh4_node
+{
+	float min_x[4], min_y[4], min_z[4];
+	float max_x[4], max_y[4], max_z[4];
+	// inner children: index of the child's node
+	// leaf children: index of the first object in bvh4::prims
+	int32_t child[4];
+	uint16_t prim_count[4];		// 0 for inner children
+	// slots from child_count on are unused
+	// they also get a box no ray can hit, but a ray with a NaN origin 'hits' every box and must not follow them back to node 0
+	uint8_t child_count;
+	uint8_t pad[7];
+};
+static_assert(sizeof(bvh4_node) == 128, "bvh4_node should be exactly two cache lines");
+
+class bvh4 : public hitable
+{
+public:
+	// collapses a tree made by bvh_node's constructor or build_bvh(), leaves are found the same way as for linear_bvh
+	bvh4(const hitable *root, float time0, float time1);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const
+	{
+		b = box;
+		return true;
+	}
+
+	std::vector<bvh4_node> nodes;
+	std::vector<hitable *> prims;
+	aabb box;
+	int depth;		// levels of nodes on the longest path from the root to a leaf, never more than the binary tree's
+
+private:
+	int add_node();
+	int collapse(const bvh_node *inner, float time0, float time1, int level);
+	void set_child(int index, int slot, const hitable *child, float time0, float time1, int level);
+	// distance along the ray to each child's box, with t_far < t_near for the children that are missed
+	void intersect_children(const bvh4_node& node, const __m128 origin[3], const __m128 inverse_dir[3], const bool dir_negative[3], float t_min, float t_max, float *t_near, float *t_far) const;
+};
+
+bvh4::bvh4(const hitable *root, float time0, float time1) : depth(1)
+{
+	TRACE_SCOPE("flatten to bvh4");
+	root->bounding_box(time0, time1, box);
+	if(const bvh_node *inner = bvh_inner_node(root))
+	{
+		collapse(inner, time0, time1, 1);
+	}
+	else
+	{
+		// the whole tree is one leaf, the root node gets one child
+		int index = add_node();
+		nodes[index].child_count = 1;
+		set_child(index, 0, root, time0, time1, 1);
+	}
+	// every level of a bvh4 takes at least one level of the binary tree, which the builders keep within BVH_MAX_DEPTH
+	assert(depth <= BVH_MAX_DEPTH);
+}
+
+// adds a node with no children and returns its index
+int bvh4::add_node()
+{
+	bvh4_node node;
+	memset(&node, 0, sizeof(node));
+	// unused slots get an 'inside out' box that no ray can hit
+	for(int i = 0;
+		i < 4;
+		i++)
+	{
+		node.min_x[i] = node.min_y[i] = node.min_z[i] = FLT_MAX;
+		node.max_x[i] = node.max_y[i] = node.max_z[i] = -FLT_MAX;
+	}
+	nodes.push_back(node);
+	return (int)nodes.size()-1;
+}
+
+// returns the index of the node made for inner, level is 1 for the root
+int bvh4::collapse(const bvh_node *inner, float time0, float time1, int level)
+{
+	if(level > depth)
+		depth = level;
+	// start with the two children and keep replacing the inner child with the biggest box by its own two children until there are 4
+	// the biggest box is the one a ray is most likely to hit, so that is the test most worth doing in the same simd step
+	const hitable *children[4] = { inner->left, inner->right, NULL, NULL };
+	int count = 2;
+	while(count < 4)
+	{
+		int best = -1;
+		float best_area = -1.0f;
+		for(int i = 0;
+			i < count;
+			i++)
+		{
+			if(bvh_inner_node(children[i]))
+			{
+				aabb child_box;
+				children[i]->bounding_box(time0, time1, child_box);
+				if(child_box.surface_area() > best_area)
+				{
+					best_area = child_box.surface_area();
+					best = i;
+				}
+			}
+		}
+		if(best < 0)
+			break;
+		const bvh_node *opened = bvh_inner_node(children[best]);
+		children[best] = opened->left;
+		children[count++] = opened->right;
+	}
+
+	int index = add_node();
+	nodes[index].child_count = (uint8_t)count;
+	for(int i = 0;
+		i < count;
+		i++)
+	{
+		set_child(index, i, children[i], time0, time1, level);
+	}
+	return index;
+}
+
+void bvh4::set_child(int index, int slot, const hitable *child, float time0, float time1, int level)
+{
+	aabb child_box;
+	child->bounding_box(time0, time1, child_box);
+	int child_index;
+	uint16_t prim_count = 0;
+	if(const bvh_node *inner = bvh_inner_node(child))
+	{
+		child_index = collapse(inner, time0, time1, level+1);
+	}
+	else
+	{
+		child_index = (int)prims.size();
+		bvh_append_leaf(child, prims);
+		assert(prims.size() - child_index <= 0xFFFF);
+		prim_count = (uint16_t)(prims.size() - child_index);
+	}
+	// nodes may have been reallocated by collapse(), so index again instead of holding a reference
+	bvh4_node& node = nodes[index];
+	node.min_x[slot] = child_box.min().x();
+	node.min_y[slot] = child_box.min().y();
+	node.min_z[slot] = child_box.min().z();
+	node.max_x[slot] = child_box.max().x();
+	node.max_y[slot] = child_box.max().y();
+	node.max_z[slot] = child_box.max().z();
+	node.child[slot] = child_index;
+	node.prim_count[slot] = prim_count;
+}
+
+// the slab test from aabb::hit done for the 4 children at once
+// dir_negative[i] picks which of a box's planes on axis i the ray enters through, like r.sign(i) does in aabb::hit
+void bvh4::intersect_children(const bvh4_node& node, const __m128 origin[3], const __m128 inverse_dir[3], const bool dir_negative[3], float t_min, float t_max, float *t_near, float *t_far) const
+{
+	RT_STAT(bvh_nodes_visited);
+	RT_STAT_ADD(box_tests, node.child_count);
+	const float *mins[3] = { node.min_x, node.min_y, node.min_z };
+	const float *maxs[3] = { node.max_x, node.max_y, node.max_z };
+	__m128 near_t = _mm_set1_ps(t_min);
+	__m128 far_t = _mm_set1_ps(t_max);
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		const float *entry_plane = dir_negative[i] ? maxs[i] : mins[i];
+		const float *exit_plane = dir_negative[i] ? mins[i] : maxs[i];
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(entry_plane), origin[i]), inverse_dir[i]);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(exit_plane), origin[i]), inverse_dir[i]);
+		// when t0 or t1 is NaN (0*infinity for a ray lying in a slab's plane) _mm_max_ps/_mm_min_ps return the second operand, so the slab is ignored
+		near_t = _mm_max_ps(t0, near_t);
+		far_t = _mm_min_ps(t1, far_t);
+	}
+	_mm_storeu_ps(t_near, near_t);
+	_mm_storeu_ps(t_far, far_t);
+}
+
+bool bvh4::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	__m128 origin[3];
+	__m128 inverse_dir[3];
+	bool dir_negative[3];
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		origin[i] = _mm_set1_ps(r.origin()[i]);
+		inverse_dir[i] = _mm_set1_ps(r.inverse_direction()[i]);
+		dir_negative[i] = r.sign(i) != 0;
+	}
+
+	// children waiting to be visited, with the distance to their box so they can be skipped if something closer has been hit since
+	struct stack_entry
+	{
+		int32_t child;
+		int32_t prim_count;
+		float t;
+	};
+	// a node pops one entry and pushes up to 4, so each level down leaves at most 3 siblings waiting
+	const int STACK_SIZE = 3*BVH_MAX_DEPTH + 1;
+	stack_entry stack[STACK_SIZE];
+	int stack_top = 0;
+	stack_entry root = { 0, 0, t_min };
+	stack[stack_top++] = root;
+	bool hit_anything = false;
+	float closest_so_far = t_max;
+	while(stack_top > 0)
+	{
+		stack_entry entry = stack[--stack_top];
+		if(entry.t >= closest_so_far)
+			continue;
+
+		if(entry.prim_count > 0)
+		{
+			for(int i = entry.child;
+				i < entry.child + entry.prim_count;
+				i++)
+			{
+				if(prims[i]->hit(r, t_min, closest_so_far, rec))
+				{
+					hit_anything = true;
+					closest_so_far = rec.t;
+				}
+			}
+			continue;
+		}
+
+		const bvh4_node& node = nodes[entry.child];
+		float t_near[4], t_far[4];
+		intersect_children(node, origin, inverse_dir, dir_negative, t_min, closest_so_far, t_near, t_far);
+		// push the children that were hit furthest first, so the nearest is popped next
+		int first = stack_top;
+		for(int i = 0;
+			i < node.child_count;
+			i++)
+		{
+			if(t_far[i] > t_near[i])
+			{
+				assert(stack_top < STACK_SIZE);
+				stack_entry child = { node.child[i], node.prim_count[i], t_near[i] };
+				int j = stack_top++;
+				while(j > first && stack[j-1].t < child.t)
+				{
+					stack[j] = stack[j-1];
+					j--;
+				}
+				stack[j] = child;
+			}
+		}
+	}
+	return hit_anything;
+}
+
+// same walk as bvh4::hit except it returns as soon as anything is hit, so the children aren't sorted
+bool bvh4::occluded(const ray& r, float t_min, float t_max) const
+{
+	__m128 origin[3];
+	__m128 inverse_dir[3];
+	bool dir_negative[3];
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		origin[i] = _mm_set1_ps(r.origin()[i]);
+		inverse_dir[i] = _mm_set1_ps(r.inverse_direction()[i]);
+		dir_negative[i] = r.sign(i) != 0;
+	}
+
+	const int STACK_SIZE = 3*BVH_MAX_DEPTH + 1;
+	int stack[STACK_SIZE];
+	int stack_top = 0;
+	stack[stack_top++] = 0;
+	while(stack_top > 0)
+	{
+		const bvh4_node& node = nodes[stack[--stack_top]];
+		float t_near[4], t_far[4];
+		intersect_children(node, origin, inverse_dir, dir_negative, t_min, t_max, t_near, t_far);
+		for(int i = 0;
+			i < node.child_count;
+			i++)
+		{
+			if(!(t_far[i] > t_near[i]))
+				continue;
+			if(node.prim_count[i] > 0)
+			{
+				for(int p = node.child[i];
+					p < node.child[i] + node.prim_count[i];
+					p++)
+				{
+					if(prims[p]->occluded(r, t_min, t_max))
+						return true;
+				}
+			}
+			else
+			{
+				assert(stack_top < STACK_SIZE);
+				stack[stack_top++] = node.child[i];
+			}
+		}
+	}
+	return false;
+}
+
+// what create_scene() puts the top level objects into
+enum accel_structure
+{
+	ACCEL_LIST,		// hitable_list, every ray tests every object
+	ACCEL_BVH,		// SAH built bvh flattened into a linear_bvh
+	ACCEL_BVH4,		// SAH built bvh collapsed into a bvh4
+};
+
+const char *accel_name(accel_structure accel)
+{
+	switch(accel)
+	{
+	case ACCEL_LIST: return "list";
+	case ACCEL_BVH: return "bvh";
+	case ACCEL_BVH4: return "bvh4";
+	}
+	return "unknown";
+}
+
+// returns false if name isn't one of the names accel_name() gives out
+bool parse_accel(const char *name, accel_structure& accel)
+{
+	const accel_structure all[] = { ACCEL_LIST, ACCEL_BVH, ACCEL_BVH4 };
+	for(size_t i = 0;
+		i < sizeof(all)/sizeof(all[0]);
+		i++)
+	{
+		if(strcmp(name, accel_name(all[i])) == 0)
+		{
+			accel = all[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+// wraps the objects in the requested acceleration structure
+// objects without a bounding box can't go in a bvh, if there are any the objects are left in a plain list
+hitable *build_accel(scene_arena& arena, hitable **list, int n, float time0, float time1, accel_structure accel)
+{
+	TRACE_SCOPE("build_accel");
+	if(accel == ACCEL_LIST)
+		return arena.make<hitable_list>(list, n);
+
+	aabb temp_box;
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		if(!list[i]->bounding_box(time0, time1, temp_box))
+			return arena.make<hitable_list>(list, n);
+	}
+	hitable *tree = build_bvh(arena, list, n, time0, time1, BVH_SPLIT_SAH);
+	if(accel == ACCEL_BVH4)
+		return arena.make<bvh4>(tree, time0, time1);
+	return arena.make<linear_bvh>(tree, time0, time1);
+}
+
+#endif
@@ -10,8 +10,10 @@
 point random_in_unit_disk()
 {
 	point p;
+	RT_STAT(unit_disk_calls);
 	do
 	{
+		RT_STAT(unit_disk_tries);
 		// produces a random point in the range (1,1,0) to (-1,-1,0)
 		p = 2.0*point(my_rand(), my_rand(), 0) - point(1.0,1.0,0.0);
 	} while(dot(p,p) >= 1.0); // selects points that fall within a sphere of radius 1, see the equation of a sphere if this is confusing
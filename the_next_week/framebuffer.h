@@ -0,0 +1,35 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include "vec3.h"
+#include <stdlib.h>
+
+// holds the rendered image as linear (not gamma corrected) floating point rgb values
+// the render threads write straight into it, each thread only ever writes pixels inside its own tiles so no locking is needed
+// pixels are stored row by row starting from the bottom row (j=0), which matches the v direction of the camera
+class framebuffer
+{
+public:
+	framebuffer(int w, int h) : width(w), height(h)
+	{
+		pixels = (rgb *)malloc(width*height*sizeof(rgb));
+	}
+	~framebuffer()
+	{
+		free(pixels);
+	}
+
+	inline rgb get(int i, int j) const { return pixels[j*width + i]; }
+	inline void set(int i, int j, const rgb& color) { pixels[j*width + i] = color; }
+
+	int width;
+	int height;
+	rgb *pixels;
+
+private:
+	// the framebuffer owns its pixels, copying it would free them twice
+	framebuffer(const framebuffer&);
+	framebuffer& operator=(const framebuffer&);
+};
+
+#endif
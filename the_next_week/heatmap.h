@@ -0,0 +1,215 @@
+#ifndef HEATMAPH
+#define HEATMAPH
+
+#include "vec3.h"
+#include "framebuffer.h"
+#include "output.h"
+#include "scheduler.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// how long each tile (and optionally each pixel) of a render took, to find the parts of a scene that are expensive to render
+// render_image() fills one in when it is given one (see the -heatmap options in main.cpp)
+// every tile is rendered by exactly one thread, so like the framebuffer it is written without any locking
+class render_timings
+{
+public:
+	render_timings(int image_nx, int image_ny, int tile_size, bool time_pixels)
+		: nx(image_nx), ny(image_ny)
+	{
+		// the same tile count as tile_scheduler, tiles are stored by their index
+		int tiles_x = (nx + tile_size-1) / tile_size;
+		int tiles_y = (ny + tile_size-1) / tile_size;
+		tiles.resize(tiles_x*tiles_y);
+		tile_seconds.assign(tiles.size(), 0.0);
+		tile_workers.assign(tiles.size(), -1);
+		if(time_pixels)
+			pixel_seconds.assign(nx*ny, 0.0f);
+	}
+
+	void set_tile(const tile& t, int worker, double seconds)
+	{
+		tiles[t.index] = t;
+		tile_workers[t.index] = worker;
+		tile_seconds[t.index] = seconds;
+	}
+	bool times_pixels() const { return !pixel_seconds.empty(); }
+	// pixels are stored like the framebuffer's, starting from the bottom row
+	void set_pixel(int i, int j, float seconds) { pixel_seconds[j*nx + i] = seconds; }
+
+	// the time a pixel took, or its share of its tile's time when pixels weren't timed one by one
+	float pixel_time(int i, int j, const std::vector<int>& pixel_tiles) const
+	{
+		if(times_pixels())
+			return pixel_seconds[j*nx + i];
+		int index = pixel_tiles[j*nx + i];
+		const tile& t = tiles[index];
+		return (float)(tile_seconds[index] / ((t.x1 - t.x0)*(t.y1 - t.y0)));
+	}
+
+	int nx, ny;
+	std::vector<tile> tiles;
+	std::vector<double> tile_seconds;
+	std::vector<int> tile_workers;		// the thread that rendered the tile
+	std::vector<float> pixel_seconds;	// empty unless pixels are timed
+};
+
+// maps 0..1 to black, purple, red, orange, yellow and then white, so the most expensive parts of the image stand out
+rgb heat_color(float x)
+{
+	static const float stops[6][3] =
+	{
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.35f, 0.0f, 0.55f },
+		{ 0.85f, 0.1f, 0.15f },
+		{ 1.0f, 0.5f, 0.0f },
+		{ 1.0f, 0.9f, 0.1f },
+		{ 1.0f, 1.0f, 1.0f },
+	};
+	if(x <= 0.0f)
+		x = 0.0f;
+	if(x >= 1.0f)
+		x = 1.0f;
+	float position = x * 5.0f;
+	int stop = (int)position;
+	if(stop > 4)
+		stop = 4;
+	float f = position - stop;
+	return rgb(stops[stop][0] + f*(stops[stop+1][0] - stops[stop][0]),
+			   stops[stop][1] + f*(stops[stop+1][1] - stops[stop][1]),
+			   stops[stop][2] + f*(stops[stop+1][2] - stops[stop][2]));
+}
+
+// the name of a file next to the render: "images/out.png" with suffix "_heatmap.png" gives "images/out_heatmap.png"
+std::string heatmap_file_name(const char *render_file, const char *suffix)
+{
+	std::string name = render_file;
+	size_t dot = name.rfind('.');
+	size_t slash = name.find_last_of("/\\");
+	if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		name.erase(dot);
+	return name + suffix;
+}
+
+// writes the timings next to render_file:
+//   <name>_heatmap.png    the time each pixel took as a false color image, scaled so the slowest 1% of pixels are white
+//                         without pixel times every pixel of a tile gets the tile's time divided by its pixel count
+//   <name>_tiles.csv      one line per tile: where it is, which thread rendered it, how long it took and that time per pixel
+//   <name>_pixels.csv     one line per pixel with its time, only when pixels were timed
+// the csv files count rows from the top of the image like the png does, x1 and y1 are one past the tile's last column and row
+bool write_heatmap(const render_timings& timings, const char *render_file)
+{
+	TRACE_SCOPE("write_heatmap");
+	int nx = timings.nx;
+	int ny = timings.ny;
+	// which tile each pixel is in
+	std::vector<int> pixel_tiles(nx*ny, 0);
+	for(size_t index = 0;
+		index < timings.tiles.size();
+		index++)
+	{
+		const tile& t = timings.tiles[index];
+		for(int j = t.y0;
+			j < t.y1;
+			j++)
+		{
+			for(int i = t.x0;
+				i < t.x1;
+				i++)
+			{
+				pixel_tiles[j*nx + i] = (int)index;
+			}
+		}
+	}
+
+	// the scale tops out at the 99th percentile instead of the slowest pixel, because a few pixels that happened to be interrupted
+	// (by the os, or a page fault) would otherwise make everything else look black
+	std::vector<float> sorted_times(nx*ny);
+	for(int j = 0;
+		j < ny;
+		j++)
+	{
+		for(int i = 0;
+			i < nx;
+			i++)
+		{
+			sorted_times[j*nx + i] = timings.pixel_time(i, j, pixel_tiles);
+		}
+	}
+	size_t percentile = (sorted_times.size() - 1) * 99 / 100;
+	std::nth_element(sorted_times.begin(), sorted_times.begin() + percentile, sorted_times.end());
+	float slowest = sorted_times[percentile];
+
+	framebuffer fb(nx, ny);
+	for(int j = 0;
+		j < ny;
+		j++)
+	{
+		for(int i = 0;
+			i < nx;
+			i++)
+		{
+			rgb color = heat_color(slowest > 0.0f ? timings.pixel_time(i, j, pixel_tiles) / slowest : 0.0f);
+			// the writer gamma corrects with a square root, squaring first means the colors come out as picked
+			fb.set(i, j, color*color);
+		}
+	}
+	std::string image_file = heatmap_file_name(render_file, "_heatmap.png");
+	bool ok = write_image(fb, image_file.c_str());
+
+	std::string tiles_file = heatmap_file_name(render_file, "_tiles.csv");
+	FILE *f = fopen(tiles_file.c_str(), "w");
+	if(f)
+	{
+		fprintf(f, "tile,x0,y0,x1,y1,thread,ms,us_per_pixel\n");
+		for(size_t index = 0;
+			index < timings.tiles.size();
+			index++)
+		{
+			const tile& t = timings.tiles[index];
+			double seconds = timings.tile_seconds[index];
+			fprintf(f, "%d,%d,%d,%d,%d,%d,%.4f,%.3f\n", (int)index, t.x0, ny - t.y1, t.x1, ny - t.y0, timings.tile_workers[index],
+					1000.0*seconds, 1000000.0*seconds / ((t.x1 - t.x0)*(t.y1 - t.y0)));
+		}
+		ok = (fclose(f) == 0) && ok;
+	}
+	else
+	{
+		printf("couldn't write %s\n", tiles_file.c_str());
+		ok = false;
+	}
+
+	if(timings.times_pixels())
+	{
+		std::string pixels_file = heatmap_file_name(render_file, "_pixels.csv");
+		f = fopen(pixels_file.c_str(), "w");
+		if(f)
+		{
+			fprintf(f, "x,y,tile,us\n");
+			for(int j = ny-1;
+				j >= 0;
+				j--)
+			{
+				for(int i = 0;
+					i < nx;
+					i++)
+				{
+					fprintf(f, "%d,%d,%d,%.3f\n", i, ny-1 - j, pixel_tiles[j*nx + i], 1000000.0*timings.pixel_seconds[j*nx + i]);
+				}
+			}
+			ok = (fclose(f) == 0) && ok;
+		}
+		else
+		{
+			printf("couldn't write %s\n", pixels_file.c_str());
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+#endif
@@ -4,13 +4,21 @@
 #include "ray.h"
 #include "aabb.h"
 #include "assert.h"
+#include "util.h"
+#include "arena.h"
+#include <float.h>
 
-// forward declaration
+// forward declarations
 class material;
+class hitable;
 
+// while a ray is being traced through the scene it can hit many objects before the closest one is found
+// so hit() only fills in t, obj and prim, and everything else is worked out once for the closest hit by finalize_hit()
 struct hit_record
 {
 	float t;
+	const hitable *obj;	// the object whose finalize() fills in the rest of the record, NULL once the record is complete
+	int prim;			// for objects that hold many primitives (e.g. sphere_set), which of them was hit
 	float u;
 	float v;
 	point hit_point;
@@ -24,18 +32,51 @@ public:
 	// tmin and tmax are to put boundaries on the min and max distance from the origin
 	// of a ray that the hit will count
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+	// returns true if anything is hit between t_min and t_max
+	// this is for shadow rays, which only need a yes or no: there is no hit_record to fill in and the search can stop at the first hit instead of looking for the closest one
+	// the default just calls hit(), objects override it when they can do better
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		hit_record rec;
+		return hit(r, t_min, t_max, rec);
+	}
 	// bounding_box returns a bool representing if the hitable has a bounding box
 	// it constructs an aabb and outputs it to the box argument
 	// t0 and t1 are time0 and time1, not t values for rays
 	virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+
+	// the following are used to sample objects that are lights (see lights.h), only simple shapes implement them
+	// get_material returns the material of a single shape, or NULL for lists, wrappers and anything that can't be sampled as a light
+	virtual material *get_material() const { return NULL; }
+	// the probability density (per unit solid angle) that random(o) picks the direction v, 0 if v doesn't hit the object
+	virtual float pdf_value(const point& o, const point& v) const { return 0.0f; }
+	// a random direction from o towards a point on the object
+	virtual point random(const point& o) const { return point(1, 0, 0); }
+
+	// fills in hit_point, normal, u, v and mat_ptr for a hit that this object reported with rec.obj == this
+	// r is the ray that was passed to that hit() call
+	virtual void finalize(const ray& r, hit_record& rec) const {}
 };
 
+// completes rec after hit() returned true, r is the ray that was passed to hit()
+// wrappers that change the ray (translate, rotate_y) call this on their child's hit straight away, unless the child is a single object they can finalize later themselves
+inline void finalize_hit(const ray& r, hit_record& rec)
+{
+	if(rec.obj)
+	{
+		const hitable *obj = rec.obj;
+		rec.obj = NULL;
+		obj->finalize(r, rec);
+	}
+}
+
 class hitable_list : public hitable
 {
 public:
 	hitable_list() {}
 	hitable_list(hitable **l, int n) { list = l; list_size = n; }
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
 
 	hitable **list;
@@ -44,23 +85,34 @@ public:
 
 bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-	hit_record temp_rec;
 	bool hit_anything = false;
 	double closest_so_far = t_max;  // prevents rendering anything behind the closest object
 	for (int i = 0;
 		i < list_size;
 		i++)
 	{
-		if (list[i]->hit(r, t_min, closest_so_far, temp_rec))
+		// hit() only writes to rec when it finds something closer than closest_so_far, so rec can be passed straight through
+		if (list[i]->hit(r, t_min, closest_so_far, rec))
 		{
 			hit_anything = true;
-			closest_so_far = temp_rec.t;
-			rec = temp_rec;
+			closest_so_far = rec.t;
 		}
 	}
 	return hit_anything;
 }
 
+bool hitable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+	for (int i = 0;
+		i < list_size;
+		i++)
+	{
+		if (list[i]->occluded(r, t_min, t_max))
+			return true;
+	}
+	return false;
+}
+
 // TODO NOTE ERROR this code is different from in book, I think there is a bug in the book code so I changed it slightly
 bool hitable_list::bounding_box(float t0, float t1, aabb& box) const
 {
@@ -93,8 +145,12 @@ class bvh_node : public hitable
 {
 public:
 	bvh_node() {}
-	bvh_node(hitable **list, int n, float time0, float time1);
+	// the inner nodes below this one are allocated in arena
+	bvh_node(scene_arena& arena, hitable **list, int n, float time0, float time1);
+	// used by builders that have already decided how to split the objects (see bvh.h)
+	bvh_node(hitable *l, hitable *r, const aabb& b) : left(l), right(r), box(b) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
 
 	// left and right can be any hitable
@@ -122,7 +178,7 @@ int box_x_compare(const void *a, const void *b) { return box_compare_generic(a,
 int box_y_compare(const void *a, const void *b) { return box_compare_generic(a, b, 1); }
 int box_z_compare(const void *a, const void *b) { return box_compare_generic(a, b, 2); }
 
-bvh_node::bvh_node(hitable **list, int n, float time0, float time1)
+bvh_node::bvh_node(scene_arena& arena, hitable **list, int n, float time0, float time1)
 {
 	assert(n > 0);
 
@@ -149,8 +205,8 @@ bvh_node::bvh_node(hitable **list, int n, float time0, float time1)
 	}
 	else // n > 2, the objects are not leaf nodes (this could be optimized to check for n==3 and make one side a leaf node)
 	{
-		left = new bvh_node(list, n/2, time0, time1);
-		right = new bvh_node(list+n/2, n-n/2, time0, time1);
+		left = arena.make<bvh_node>(arena, list, n/2, time0, time1);
+		right = arena.make<bvh_node>(arena, list+n/2, n-n/2, time0, time1);
 	}
 	aabb box_left, box_right;
 	if(!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
@@ -166,35 +222,26 @@ bool bvh_node::bounding_box(float t0, float t1, aabb& b) const
 
 bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-	if(box.hit(r, t_min, t_max))
-	{
-		// the following 2 calls are recursive
-		hit_record left_rec, right_rec;
-		bool hit_left = left->hit(r, t_min, t_max, left_rec);
-		bool hit_right = right->hit(r, t_min, t_max, right_rec);
-		if(hit_left && hit_right)
-		{
-			if(left_rec.t < right_rec.t)
-				rec = left_rec;
-			else
-				rec = right_rec;
-			return true;
-		}
-		else if(hit_left)
-		{
-			rec = left_rec;
-			return true;
-		}
-		else if(hit_right)
-		{
-			rec = right_rec;
-			return true;
-		}
-		else
-			return false;
-	}
-	else
+	RT_STAT(bvh_nodes_visited);
+	if(!box.hit(r, t_min, t_max))
+		return false;
+	// the following 2 calls are recursive
+	// hit() only writes to rec when it finds a hit between t_min and t_max, so both sides can share rec
+	// the right side only has to look for something closer than whatever the left side found, which lets it skip most of its boxes
+	bool hit_left = left->hit(r, t_min, t_max, rec);
+	bool hit_right = false;
+	if(right != left)
+		hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+	return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, float t_min, float t_max) const
+{
+	RT_STAT(bvh_nodes_visited);
+	if(!box.hit(r, t_min, t_max))
 		return false;
+	// the right side is never looked at if the left side already blocks the ray
+	return left->occluded(r, t_min, t_max) || (right != left && right->occluded(r, t_min, t_max));
 }
 
 // this is used to get texture co-ordinates from a hitpoint on a sphere
@@ -221,13 +268,41 @@ void get_sphere_uv(const point& p, float& u, float& v)
 	v = (theta + M_PI/2) / M_PI; // y=1 maps to 1, y=-1 maps to -1
 }
 
+// the same quadratic as sphere::hit (see the comments there), but only checks if either root is between t_min and t_max
+// shared by sphere and moving_sphere
+bool sphere_occluded(const ray& r, const point& center, float radius, float t_min, float t_max)
+{
+	RT_STAT(primitive_tests);
+	point oc = r.origin() - center;
+	float a = dot(r.direction(), r.direction());
+	float b = 2.0*dot(oc, r.direction());
+	float c = dot(oc, oc) - radius*radius;
+	float discriminant = b*b - 4*a*c;
+	if (discriminant <= 0)
+		return false;
+	float root = sqrt(discriminant);
+	float temp = (-b - root)/(2.0*a);
+	if (temp < t_max && temp > t_min)
+		return true;
+	temp = (-b + root)/(2.0*a);
+	return temp < t_max && temp > t_min;
+}
+
 class sphere : public hitable
 {
 public:
 	sphere() {}
 	sphere(point cen, float r, material *m) : center(cen), radius(r), mtrl(m) {};
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return sphere_occluded(r, center, radius, t_min, t_max);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual material *get_material() const { return mtrl; }
+	virtual float pdf_value(const point& o, const point& v) const;
+	virtual point random(const point& o) const;
+	virtual void finalize(const ray& r, hit_record& rec) const;
 
 	point center;
 	float radius;
@@ -236,6 +311,7 @@ public:
 
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+	RT_STAT(primitive_tests);
 	// equation for a sphere at (0, 0, 0) with radius R is:
 	// x*x + y*y + z*z = R*R
 	// in English:
@@ -282,32 +358,37 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 	float discriminant = b*b - 4*a*c;
 	if (discriminant > 0)
 	{
+		// the rest of the hit_record is only worked out if this turns out to be the closest hit (see sphere::finalize)
 		float temp = (-b - sqrt(discriminant))/(2.0*a);
 		if (temp < t_max && temp > t_min)
 		{
 			rec.t = temp;
-			rec.hit_point = r.point_at_parameter(rec.t);
-			// (rec.hit_point - center) gives vector from origin that points in same direction as center to rec.hit_point
-			// (rec.hit_point - center) has a magnitude of radius, dividing it by radius gives a unit vector
-			rec.normal = (rec.hit_point - center) / radius;
-			rec.mat_ptr = mtrl;
-			get_sphere_uv(rec.normal, rec.u, rec.v);  // functions outputs to rec.u and rec.v
+			rec.obj = this;
+			rec.prim = 0;
 			return true;
 		}
 		temp = (-b + sqrt(discriminant))/(2.0*a);
 		if (temp < t_max && temp > t_min)
 		{
 			rec.t = temp;
-			rec.hit_point = r.point_at_parameter(rec.t);
-			rec.normal = (rec.hit_point - center) / radius;
-			rec.mat_ptr = mtrl;
-			get_sphere_uv(rec.normal, rec.u, rec.v);  // functions outputs to rec.u and rec.v
+			rec.obj = this;
+			rec.prim = 0;
 			return true;
 		}
 	}
 	return false;
 }
 
+void sphere::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	// (rec.hit_point - center) gives vector from origin that points in same direction as center to rec.hit_point
+	// (rec.hit_point - center) has a magnitude of radius, dividing it by radius gives a unit vector
+	rec.normal = (rec.hit_point - center) / radius;
+	rec.mat_ptr = mtrl;
+	get_sphere_uv(rec.normal, rec.u, rec.v);  // functions outputs to rec.u and rec.v
+}
+
 bool sphere::bounding_box(float t0, float t1, aabb& box) const
 {
 	box = aabb(center - point(radius, radius, radius),
@@ -315,6 +396,45 @@ bool sphere::bounding_box(float t0, float t1, aabb& box) const
 	return true;
 }
 
+// seen from o, the sphere covers a cone of directions around the direction to its center
+// theta_max is the angle between the edge of the cone and its center: sin(theta_max) = radius / distance to center
+// picking directions uniformly inside the cone gives a pdf of 1 / (solid angle of the cone) = 1 / (2*pi*(1 - cos(theta_max)))
+// from inside the sphere (e.g. a sky dome) every direction hits it, so directions are picked uniformly over the whole sphere of directions instead
+float sphere::pdf_value(const point& o, const point& v) const
+{
+	hit_record rec;
+	if(!this->hit(ray(o, v), 0.001, FLT_MAX, rec))
+		return 0.0f;
+	float distance_squared = (center-o).squared_length();
+	if(distance_squared <= radius*radius)
+		return 1.0f / (4*M_PI);
+	float cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+	float solid_angle = 2*M_PI*(1-cos_theta_max);
+	return 1.0f / solid_angle;
+}
+
+point sphere::random(const point& o) const
+{
+	point direction = center - o;
+	float distance_squared = direction.squared_length();
+	if(distance_squared <= radius*radius)
+		return random_unit_vector();  // o is inside the sphere, see pdf_value()
+	// pick a direction inside the cone, in a co-ordinate system where the cone points along z
+	float r1 = my_rand();
+	float r2 = my_rand();
+	float cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+	float z = 1 + r2*(cos_theta_max-1);  // uniformly picks cos(theta) between cos_theta_max and 1
+	float phi = 2*M_PI*r1;
+	float sin_theta = sqrt(1-z*z);
+	point local(cos(phi)*sin_theta, sin(phi)*sin_theta, z);
+	// build two axes perpendicular to the direction of the sphere and rotate local into world space
+	point w = unit_vector(direction);
+	point a = (fabs(w.x()) > 0.9) ? point(0, 1, 0) : point(1, 0, 0);
+	point v = unit_vector(cross(w, a));
+	point u = cross(w, v);
+	return local.x()*u + local.y()*v + local.z()*w;
+}
+
 class moving_sphere : public hitable
 {
 public:
@@ -322,7 +442,12 @@ public:
 	moving_sphere(point cen0, point cen1, float t0, float t1, float r, material *m)
 		: center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mtrl(m) {};
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return sphere_occluded(r, center(r.time()), radius, t_min, t_max);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void finalize(const ray& r, hit_record& rec) const;
 	point center(float time) const;
 
 	point center0, center1;
@@ -348,6 +473,7 @@ bool moving_sphere::bounding_box(float t0, float t1, aabb& box) const
 
 bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+	RT_STAT(primitive_tests);
 	point oc = r.origin() - center(r.time());
 	float a = dot(r.direction(), r.direction());
 	float b = 2.0*dot(oc, r.direction());
@@ -359,20 +485,16 @@ bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec)
 		if (temp < t_max && temp > t_min)
 		{
 			rec.t = temp;
-			rec.hit_point = r.point_at_parameter(rec.t);
-			// (rec.hit_point - center) gives vector from origin that points in same direction as center to rec.hit_point
-			// (rec.hit_point - center) has a magnitude of radius, dividing it by radius gives a unit vector
-			rec.normal = (rec.hit_point - center(r.time())) / radius;
-			rec.mat_ptr = mtrl;
+			rec.obj = this;
+			rec.prim = 0;
 			return true;
 		}
 		temp = (-b + sqrt(discriminant))/(2.0*a);
 		if (temp < t_max && temp > t_min)
 		{
 			rec.t = temp;
-			rec.hit_point = r.point_at_parameter(rec.t);
-			rec.normal = (rec.hit_point - center(r.time())) / radius;
-			rec.mat_ptr = mtrl;
+			rec.obj = this;
+			rec.prim = 0;
 			return true;
 		}
 	}
@@ -380,6 +502,29 @@ bool moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec)
 	
 }
 
+void moving_sphere::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	// (rec.hit_point - center) gives vector from origin that points in same direction as center to rec.hit_point
+	// (rec.hit_point - center) has a magnitude of radius, dividing it by radius gives a unit vector
+	rec.normal = (rec.hit_point - center(r.time())) / radius;
+	rec.mat_ptr = mtrl;
+}
+
+// picking a point uniformly on a rectangle has a pdf of 1/area per unit of area
+// light sampling needs the pdf per unit of solid angle (as seen from the point the ray starts at), which is:
+// distance^2 / (cosine * area)
+// where cosine is between the direction and the rectangle's normal, so a rectangle seen from the side (small solid angle) gets a high pdf
+// t is where the ray with direction v hits the rectangle and axis is the axis the rectangle's normal points along
+float rect_pdf_value(float t, const point& v, float area, int axis)
+{
+	float distance_squared = t*t*v.squared_length();
+	float cosine = fabs(v[axis]) / v.length();
+	if(cosine <= 0.0f)
+		return 0.0f;
+	return distance_squared / (cosine*area);
+}
+
 // a rectangle is defined by a plane
 // for an xy plane, the equation of the plane is z=k
 // the boundaries of the rectangle are defined by 4 lines on the plane z=k
@@ -392,12 +537,36 @@ public:
 	xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat)
 		: x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mat_ptr(mat) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		// see xy_rect::hit
+		RT_STAT(primitive_tests);
+		float t = (k-r.origin().z()) / r.direction().z();
+		if(t<t_min || t>t_max) return false;
+		float x = r.origin().x() + t*r.direction().x();
+		float y = r.origin().y() + t*r.direction().y();
+		return !(x<x0 || x>x1 || y<y0 || y>y1);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		// the k-0.0001 and k+0.0001 is to create a small amount of padding for the aabb
 		box = aabb(point(x0, y0, k-0.0001), point(x1, y1, k+0.0001));
 		return true;
 	}
+	virtual material *get_material() const { return mat_ptr; }
+	virtual void finalize(const ray& r, hit_record& rec) const;
+	virtual float pdf_value(const point& o, const point& v) const
+	{
+		hit_record rec;
+		if(!this->hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return rect_pdf_value(rec.t, v, (x1-x0)*(y1-y0), 2);
+	}
+	virtual point random(const point& o) const
+	{
+		point on_rect(x0 + my_rand()*(x1-x0), y0 + my_rand()*(y1-y0), k);
+		return on_rect - o;
+	}
 	material *mat_ptr;
 	float k;				// the plane of the rectangle
 	float x0, x1, y0, y1;	// the planes that define the boundaries of the rectangle
@@ -405,6 +574,7 @@ public:
 
 bool xy_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+	RT_STAT(primitive_tests);
 	// the ray equation is r = A + t*B
 	// finding where the ray intersects the z=k plane is done with the z components of the A and B vectors
 	// rz = Az + t*Bz where rz, Az and Bz are the z components of r, A and B
@@ -421,14 +591,20 @@ bool xy_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 	float x = r.origin().x() + t*r.direction().x();
 	float y = r.origin().y() + t*r.direction().y();
 	if(x<x0 || x>x1 || y<y0 || y>y1) return false;
-	// u and v are texture co-ordinates
-	rec.u = (x-x0)/(x1-x0);
-	rec.v = (y-y0)/(y1-y0);
 	rec.t = t;
+	rec.obj = this;
+	rec.prim = 0;
+	return true;
+}
+
+void xy_rect::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	// u and v are texture co-ordinates
+	rec.u = (rec.hit_point.x()-x0)/(x1-x0);
+	rec.v = (rec.hit_point.y()-y0)/(y1-y0);
 	rec.mat_ptr = mat_ptr;
-	rec.hit_point = r.point_at_parameter(t);
 	rec.normal = point(0,0,1);
-	return true;
 }
 
 class xz_rect : public hitable
@@ -438,12 +614,36 @@ public:
 	xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat)
 		: x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		// see xz_rect::hit
+		RT_STAT(primitive_tests);
+		float t = (k-r.origin().y()) / r.direction().y();
+		if(t<t_min || t>t_max) return false;
+		float x = r.origin().x() + t*r.direction().x();
+		float z = r.origin().z() + t*r.direction().z();
+		return !(x<x0 || x>x1 || z<z0 || z>z1);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		// the k-0.0001 and k+0.0001 is to create a small amount of padding for the aabb
 		box = aabb(point(x0, k-0.0001, z0), point(x1, k+0.0001, z1));
 		return true;
 	}
+	virtual material *get_material() const { return mat_ptr; }
+	virtual void finalize(const ray& r, hit_record& rec) const;
+	virtual float pdf_value(const point& o, const point& v) const
+	{
+		hit_record rec;
+		if(!this->hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return rect_pdf_value(rec.t, v, (x1-x0)*(z1-z0), 1);
+	}
+	virtual point random(const point& o) const
+	{
+		point on_rect(x0 + my_rand()*(x1-x0), k, z0 + my_rand()*(z1-z0));
+		return on_rect - o;
+	}
 	material *mat_ptr;
 	float k;				// the plane of the rectangle
 	float x0, x1, z0, z1;	// the planes that define the boundaries of the rectangle
@@ -451,19 +651,26 @@ public:
 
 bool xz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+	RT_STAT(primitive_tests);
 	float t = (k-r.origin().y()) / r.direction().y();
 	if(t<t_min || t>t_max) return false;
 	float x = r.origin().x() + t*r.direction().x();
 	float z = r.origin().z() + t*r.direction().z();
 	if(x<x0 || x>x1 || z<z0 || z>z1) return false;
-	// u and v are texture co-ordinates
-	rec.u = (x-x0)/(x1-x0);
-	rec.v = (z-z0)/(z1-z0);
 	rec.t = t;
+	rec.obj = this;
+	rec.prim = 0;
+	return true;
+}
+
+void xz_rect::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	// u and v are texture co-ordinates
+	rec.u = (rec.hit_point.x()-x0)/(x1-x0);
+	rec.v = (rec.hit_point.z()-z0)/(z1-z0);
 	rec.mat_ptr = mat_ptr;
-	rec.hit_point = r.point_at_parameter(t);
 	rec.normal = point(0,1,0);
-	return true;
 }
 
 class yz_rect : public hitable
@@ -473,12 +680,36 @@ public:
 	yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat)
 		: y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		// see yz_rect::hit
+		RT_STAT(primitive_tests);
+		float t = (k-r.origin().x()) / r.direction().x();
+		if(t<t_min || t>t_max) return false;
+		float y = r.origin().y() + t*r.direction().y();
+		float z = r.origin().z() + t*r.direction().z();
+		return !(y<y0 || y>y1 || z<z0 || z>z1);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		// the k-0.0001 and k+0.0001 is to create a small amount of padding for the aabb
 		box = aabb(point(k-0.0001, y0, z0), point(k+0.0001, y1, z1));
 		return true;
 	}
+	virtual material *get_material() const { return mat_ptr; }
+	virtual void finalize(const ray& r, hit_record& rec) const;
+	virtual float pdf_value(const point& o, const point& v) const
+	{
+		hit_record rec;
+		if(!this->hit(ray(o, v), 0.001, FLT_MAX, rec))
+			return 0.0f;
+		return rect_pdf_value(rec.t, v, (y1-y0)*(z1-z0), 0);
+	}
+	virtual point random(const point& o) const
+	{
+		point on_rect(k, y0 + my_rand()*(y1-y0), z0 + my_rand()*(z1-z0));
+		return on_rect - o;
+	}
 	material *mat_ptr;
 	float k;				// the plane of the rectangle
 	float y0, y1, z0, z1;	// the planes that define the boundaries of the rectangle
@@ -486,19 +717,26 @@ public:
 
 bool yz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
+	RT_STAT(primitive_tests);
 	float t = (k-r.origin().x()) / r.direction().x();
 	if(t<t_min || t>t_max) return false;
 	float y = r.origin().y() + t*r.direction().y();
 	float z = r.origin().z() + t*r.direction().z();
 	if(y<y0 || y>y1 || z<z0 || z>z1) return false;
-	// u and v are texture co-ordinates
-	rec.u = (y-y0)/(y1-y0);
-	rec.v = (z-z0)/(z1-z0);
 	rec.t = t;
+	rec.obj = this;
+	rec.prim = 0;
+	return true;
+}
+
+void yz_rect::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	// u and v are texture co-ordinates
+	rec.u = (rec.hit_point.y()-y0)/(y1-y0);
+	rec.v = (rec.hit_point.z()-z0)/(z1-z0);
 	rec.mat_ptr = mat_ptr;
-	rec.hit_point = r.point_at_parameter(t);
 	rec.normal = point(1,0,0);
-	return true;
 }
 
 // this class wraps another hitable object in order to flip the normal of the hit_record
@@ -511,54 +749,142 @@ public:
 	{
 		if(ptr->hit(r, t_min, t_max, rec))
 		{
-			rec.normal = -rec.normal;
+			// when the hit came straight from ptr, flipping can wait until finalize()
+			// otherwise (ptr holds other objects) it has to be finalized now, because there is no way to get back to the object that was hit later
+			if(rec.obj == ptr)
+			{
+				rec.obj = this;
+			}
+			else
+			{
+				finalize_hit(r, rec);
+				rec.normal = -rec.normal;
+			}
 			return true;
 		}
 		else
 			return false;
 	}
+	virtual void finalize(const ray& r, hit_record& rec) const
+	{
+		ptr->finalize(r, rec);
+		rec.normal = -rec.normal;
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		return ptr->bounding_box(t0, t1, box);
 	}
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(r, t_min, t_max);
+	}
+	// flipping the normal doesn't change which directions hit the object
+	virtual material *get_material() const { return ptr->get_material(); }
+	virtual float pdf_value(const point& o, const point& v) const { return ptr->pdf_value(o, v); }
+	virtual point random(const point& o) const { return ptr->random(o); }
 	hitable *ptr;
 };
 
+// a box made of 6 axis aligned faces, intersected the same way as an aabb (a single slab test, see aabb.h) rather than as 6 rects
+// the faces are numbered 2*axis + side, where side is 0 for the face on the min corner's side and 1 for the max corner's side
+// the normals point out of the box and the uv's on each face are the same as the rect on that face would give
 class box : public hitable
 {
 public:
 	box() {}
-	box(const point& p0, const point& p1, material *mat_ptr);
+	box(const point& p0, const point& p1, material *mat) : p_min(p0), p_max(p1), mat_ptr(mat) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		float t;
+		int face;
+		return intersect(r, t_min, t_max, t, face);
+	}
+	virtual void finalize(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		box = aabb(p_min, p_max);
 		return true;
 	}
 	point p_min, p_max;
-	hitable *list_ptr;
+	material *mat_ptr;
+
+private:
+	bool intersect(const ray& r, float t_min, float t_max, float& t, int& face) const;
 };
 
-box::box(const point& p0, const point& p1, material *mat_ptr)
+// the slab test finds where the ray enters the box (the furthest of the 3 entry planes) and where it leaves (the nearest of the 3 exit planes)
+// the hit is the entry point, or the exit point when the ray starts inside the box (e.g. fog boundaries, see constant_medium)
+bool box::intersect(const ray& r, float t_min, float t_max, float& t, int& face) const
 {
-	p_min = p0;
-	p_max = p1;
-	hitable **list = new hitable*[6];
-	// xy planes (front/back)
-	list[0] = 					new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat_ptr);
-	list[1] = new flip_normals(	new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat_ptr));
-	// xz planes (top/bottom)
-	list[2] = 					new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat_ptr);
-	list[3] = new flip_normals(	new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat_ptr));
-	// yz planes (left/right)
-	list[4] = 					new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat_ptr);
-	list[5] = new flip_normals(	new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat_ptr));
-	list_ptr = new hitable_list(list, 6);
+	RT_STAT(primitive_tests);
+	const point bounds[2] = { p_min, p_max };
+	float t_near = -FLT_MAX;
+	float t_far = FLT_MAX;
+	int near_face = 0;
+	int far_face = 0;
+	for(int i = 0;
+		i < 3;
+		i++)
+	{
+		// a ray going in the negative direction enters through the max side and leaves through the min side
+		int s = r.sign(i);
+		float t0 = (bounds[s][i] - r.A[i]) * r.inv_B[i];
+		float t1 = (bounds[1-s][i] - r.A[i]) * r.inv_B[i];
+		if(t0 > t_near)
+		{
+			t_near = t0;
+			near_face = 2*i + s;
+		}
+		if(t1 < t_far)
+		{
+			t_far = t1;
+			far_face = 2*i + 1-s;
+		}
+	}
+	if(!(t_near <= t_far))
+		return false;
+	// the same range check as the rects
+	if(t_near >= t_min && t_near <= t_max)
+	{
+		t = t_near;
+		face = near_face;
+		return true;
+	}
+	if(t_far >= t_min && t_far <= t_max)
+	{
+		t = t_far;
+		face = far_face;
+		return true;
+	}
+	return false;
 }
 
 bool box::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-	return list_ptr->hit(r, t_min, t_max, rec);
+	float t;
+	int face;
+	if(!intersect(r, t_min, t_max, t, face))
+		return false;
+	rec.t = t;
+	rec.obj = this;
+	rec.prim = face;
+	return true;
+}
+
+void box::finalize(const ray& r, hit_record& rec) const
+{
+	rec.hit_point = r.point_at_parameter(rec.t);
+	int axis = rec.prim / 2;
+	int side = rec.prim % 2;
+	rec.normal = point(0,0,0);
+	rec.normal[axis] = side ? 1.0f : -1.0f;
+	// u and v run along the other 2 axes in order (y and z on an x face, x and z on a y face, x and y on a z face), like yz_rect, xz_rect and xy_rect
+	int u_axis = axis == 0 ? 1 : 0;
+	int v_axis = axis == 2 ? 1 : 2;
+	rec.u = (rec.hit_point[u_axis]-p_min[u_axis])/(p_max[u_axis]-p_min[u_axis]);
+	rec.v = (rec.hit_point[v_axis]-p_min[v_axis])/(p_max[v_axis]-p_min[v_axis]);
+	rec.mat_ptr = mat_ptr;
 }
 
 // instances: in ray tracing, an 'instance' is a geometric primitive that has been moved or rotated
@@ -572,7 +898,14 @@ class translate : public hitable
 public:
 	translate(hitable *p, const point& displacement) : ptr(p), offset(displacement) {}
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		// moving the ray is all that is needed, there is no hit_point to move back
+		ray moved_r(r.origin() - offset, r.direction(), r.time());
+		return ptr->occluded(moved_r, t_min, t_max);
+	}
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void finalize(const ray& r, hit_record& rec) const;
 	hitable *ptr;
 	point offset;
 };
@@ -586,13 +919,29 @@ bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) con
 	ray moved_r(r.origin() - offset, r.direction(), r.time());
 	if(ptr->hit(moved_r, t_min, t_max, rec))
 	{
-		rec.hit_point += offset;
+		// like flip_normals, a hit straight from ptr is finalized later and anything else now
+		if(rec.obj == ptr)
+		{
+			rec.obj = this;
+		}
+		else
+		{
+			finalize_hit(moved_r, rec);
+			rec.hit_point += offset;
+		}
 		return true;
 	}
 	else
 		return false;
 }
 
+void translate::finalize(const ray& r, hit_record& rec) const
+{
+	ray moved_r(r.origin() - offset, r.direction(), r.time());
+	ptr->finalize(moved_r, rec);
+	rec.hit_point += offset;
+}
+
 bool translate::bounding_box(float t0, float t1, aabb& box) const
 {
 	if(ptr->bounding_box(t0, t1, box))
@@ -622,6 +971,8 @@ public:
 	// angle is in degrees
 	rotate_y(hitable *p, float angle);
 	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual void finalize(const ray& r, hit_record& rec) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const
 	{
 		// TODO should change this so it only sets box after checking has_box ?
@@ -633,6 +984,10 @@ public:
 	float cos_theta;
 	bool has_box;
 	aabb b_box;
+
+private:
+	ray rotate_ray(const ray& r) const;
+	void rotate_hit(hit_record& rec) const;
 };
 
 rotate_y::rotate_y(hitable *p, float angle) : ptr(p)
@@ -679,10 +1034,10 @@ rotate_y::rotate_y(hitable *p, float angle) : ptr(p)
 	b_box = aabb(min, max);
 }
 
-bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+// rotates a ray into the object's (unrotated) space
+ray rotate_y::rotate_ray(const ray& r) const
 {
 	// the origin and direction of the ray are rotated about the y axis and used to create a new temporary ray
-	// the new temporary ray is used to check if it hits the object
 	// note that the rotated ray is rotated in the opposite direction than the object is supposed to be rotated
 	// rotating an object by 20 degrees is equivalent to rotating the camera by -20 degrees
 	point new_origin = r.origin();
@@ -692,26 +1047,57 @@ bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 	new_origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
 	new_direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
 	new_direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
+	return ray(new_origin, new_direction, r.time());
+}
 
-	ray rotated_r(new_origin, new_direction, r.time());
+// the hit_point and normal for a finalized hit_record are changed to their positions on the rotated object
+// note that these are rotated in the opposite direction than the camera was
+void rotate_y::rotate_hit(hit_record& rec) const
+{
+	point new_hit_point = rec.hit_point;
+	point new_normal = rec.normal;
+	new_hit_point[0] = cos_theta*rec.hit_point[0] + sin_theta*rec.hit_point[2];
+	new_hit_point[2] = -sin_theta*rec.hit_point[0] + cos_theta*rec.hit_point[2];
+	new_normal[0] = cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
+	new_normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
+	rec.hit_point = new_hit_point;
+	rec.normal = new_normal;
+}
+
+bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	// the rotated ray is used to check if it hits the object
+	ray rotated_r = rotate_ray(r);
 	if(ptr->hit(rotated_r, t_min, t_max, rec))
 	{
-		// the hit_point and normal for the hit_record are changed to their positions on the rotated object
-		// note that these are rotated in the opposite direction than the camera was
-		point new_hit_point = rec.hit_point;
-		point new_normal = rec.normal;
-		new_hit_point[0] = cos_theta*rec.hit_point[0] + sin_theta*rec.hit_point[2];
-		new_hit_point[2] = -sin_theta*rec.hit_point[0] + cos_theta*rec.hit_point[2];
-		new_normal[0] = cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-		new_normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
-		rec.hit_point = new_hit_point;
-		rec.normal = new_normal;
+		// like flip_normals, a hit straight from ptr is finalized later and anything else now
+		if(rec.obj == ptr)
+		{
+			rec.obj = this;
+		}
+		else
+		{
+			finalize_hit(rotated_r, rec);
+			rotate_hit(rec);
+		}
 		return true;
 	}
 	else
 		return false;
 }
 
+void rotate_y::finalize(const ray& r, hit_record& rec) const
+{
+	ptr->finalize(rotate_ray(r), rec);
+	rotate_hit(rec);
+}
+
+bool rotate_y::occluded(const ray& r, float t_min, float t_max) const
+{
+	// same ray rotation as rotate_y::hit, there is no hit_point or normal to rotate back
+	return ptr->occluded(rotate_ray(r), t_min, t_max);
+}
+
 // the maths for rotating about the z axis is:
 // x' = cos(theta)*x - sin(theta)*y
 // y' = sin(theta)*x + cos(theta)*y
@@ -727,6 +1113,7 @@ bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 // to reverse the direction of rotation:
 // cos(-theta) = cos(theta)
 // sin(-theta) = -sin(theta)
+// rather than a wrapper class per axis, these are mat4_rotation_x and mat4_rotation_z in mat4.h, used with instance (see instance.h)
 
 // volumes (fog/smoke object)
 class constant_medium : public hitable
@@ -760,8 +1147,12 @@ bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& re
 			float hit_distance = -(1/density)*log(my_rand());
 			if(hit_distance < distance_inside_boundary)
 			{
+				// t and hit_point need to be set so the caller knows how close this hit is (and bvh traversal can prune against it)
+				rec.t = rec1.t + hit_distance / r.direction().length();
+				rec.hit_point = r.point_at_parameter(rec.t);
 				rec.normal = point(1,0,0); // this is arbitrary (its' from the book)
 				rec.mat_ptr = phase_function;
+				rec.obj = NULL;  // everything is already filled in
 				return true;
 			}
 		}
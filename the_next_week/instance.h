@@ -0,0 +1,196 @@
+#ifndef INSTANCEH
+#define INSTANCEH
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+#include "bvh.h"
+#include "trace.h"
+#include "mat4.h"
+#include <stdint.h>
+#include <vector>
+
+// an instance is a copy of an object placed somewhere in the scene by a transform, the object itself is shared by every copy
+// like translate and rotate_y the ray is moved into the object's space instead of moving the object, but any mix of
+// rotations (about any axis), scales and translations is one matrix, so a copy costs two matrices and a box instead of its own geometry
+// it is also cheaper than a chain of wrappers like translate(rotate_y(...)): one virtual call, one ray and one fix-up of the hit_record
+// instead of one of each per wrapper, e.g. new instance(object, mat4_translation(offset) * mat4_rotation_y(angle))
+// ----
+// the ray's direction isn't normalized after it is transformed, so t along the transformed ray is the same as t along the original one
+// and t_min/t_max/rec.t don't need converting
+class instance : public hitable
+{
+public:
+	instance() {}
+	instance(const hitable *p, const mat4& object_to_world);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const
+	{
+		return ptr->occluded(object_ray(r), t_min, t_max);
+	}
+	virtual void finalize(const ray& r, hit_record& rec) const;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const
+	{
+		box = world_box;
+		return has_box;
+	}
+	const hitable *ptr;
+	mat4 to_world;
+	mat4 to_object;
+	aabb world_box;		// worked out once here, the top level bvh is built from these
+	bool has_box;
+
+private:
+	ray object_ray(const ray& r) const
+	{
+		return ray(transform_point(to_object, r.origin()), transform_vector(to_object, r.direction()), r.time());
+	}
+	void world_hit(hit_record& rec) const
+	{
+		rec.hit_point = transform_point(to_world, rec.hit_point);
+		rec.normal = unit_vector(transform_normal(to_object, rec.normal));
+	}
+};
+
+instance::instance(const hitable *p, const mat4& object_to_world) : ptr(p), to_world(object_to_world)
+{
+	to_object = mat4_affine_inverse(to_world);
+	aabb object_box;
+	has_box = ptr->bounding_box(0, 1, object_box);
+	if(has_box)
+		world_box = transform_box(to_world, object_box);
+}
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	ray moved_r = object_ray(r);
+	if(ptr->hit(moved_r, t_min, t_max, rec))
+	{
+		// like translate, a hit straight from ptr is finalized later and anything else now
+		if(rec.obj == ptr)
+		{
+			rec.obj = this;
+		}
+		else
+		{
+			finalize_hit(moved_r, rec);
+			world_hit(rec);
+		}
+		return true;
+	}
+	else
+		return false;
+}
+
+void instance::finalize(const ray& r, hit_record& rec) const
+{
+	ptr->finalize(object_ray(r), rec);
+	world_hit(rec);
+}
+
+// the top level of a two level acceleration structure: a bvh over instances, where each instance points at a shared bottom level
+// structure (a mesh, a bvh of objects, or a single object) that is only built once however many copies of it there are
+// the instances are stored by value in one array, in the order of the bvh's leaves, so there is no allocation per copy
+// the bvh uses the same linear_bvh_node layout and traversal as linear_bvh
+class instance_bvh : public hitable
+{
+public:
+	instance_bvh() {}
+	// copies of object can be added until build() is called
+	void add(const hitable *object, const mat4& object_to_world)
+	{
+		instances.push_back(instance(object, object_to_world));
+	}
+	void build(int max_leaf_size = 2);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const
+	{
+		b = box;
+		return !nodes.empty();
+	}
+	int instance_count() const { return (int)instances.size(); }
+
+	std::vector<instance> instances;
+	std::vector<linear_bvh_node> nodes;
+	aabb box;
+};
+
+void instance_bvh::build(int max_leaf_size)
+{
+	TRACE_SCOPE("instance_bvh build");
+	nodes.clear();
+	int n = (int)instances.size();
+	if(n == 0)
+		return;
+
+	bvh_build_prim *prims = new bvh_build_prim[n];
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		// instances without a box (e.g. of an infinite object) can't go in a bvh
+		assert(instances[i].has_box);
+		prims[i].box = instances[i].world_box;
+		prims[i].centroid = 0.5f*(prims[i].box.min() + prims[i].box.max());
+		prims[i].index = i;
+	}
+	nodes.reserve(2*n);
+	linear_bvh_build(nodes, prims, n, 0, max_leaf_size);
+	box = aabb(point(nodes[0].box_min[0], nodes[0].box_min[1], nodes[0].box_min[2]),
+			   point(nodes[0].box_max[0], nodes[0].box_max[1], nodes[0].box_max[2]));
+
+	// put the instances in the order of the bvh's leaves
+	std::vector<instance> old_instances;
+	old_instances.swap(instances);
+	instances.reserve(n);
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		instances.push_back(old_instances[prims[i].index]);
+	}
+	delete[] prims;
+}
+
+bool instance_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	if(nodes.empty())
+		return false;
+	return linear_bvh_closest_hit(&nodes[0], r, t_min, t_max, [&](int first, int count, float& closest_so_far)
+	{
+		bool hit_anything = false;
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			// instances is an array of instance, not of pointers, so this doesn't need to be a virtual call
+			if(instances[i].instance::hit(r, t_min, closest_so_far, rec))
+			{
+				hit_anything = true;
+				closest_so_far = rec.t;
+			}
+		}
+		return hit_anything;
+	});
+}
+
+bool instance_bvh::occluded(const ray& r, float t_min, float t_max) const
+{
+	if(nodes.empty())
+		return false;
+	return linear_bvh_any_hit(&nodes[0], r, t_min, t_max, [&](int first, int count)
+	{
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			if(instances[i].instance::occluded(r, t_min, t_max))
+				return true;
+		}
+		return false;
+	});
+}
+
+#endif
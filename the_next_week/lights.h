@@ -0,0 +1,76 @@
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include "hitable.h"
+#include "material.h"
+#include <vector>
+
+// the objects in a scene that emit light
+// scenes with small lights are noisy when the only way to find a light is for a random bounce to happen to hit it
+// 'next event estimation' fixes this by sending a ray straight towards a random point on a light at every bounce (see color() in render.h)
+// this class picks those points and gives the probability density of picking a direction, which is needed to weight the result
+class light_list
+{
+public:
+	// adds every object in list that has an emissive material
+	// only top level objects are looked at, lights inside wrappers (translate, constant_medium, etc.) are still found by random bounces but never sampled directly
+	void collect(hitable **list, int n)
+	{
+		for(int i = 0;
+			i < n;
+			i++)
+		{
+			material *m = list[i]->get_material();
+			if(m && m->is_emissive())
+				lights.push_back(list[i]);
+		}
+	}
+
+	bool empty() const { return lights.empty(); }
+
+	// picks one light with equal probability, light->random(o) then gives a direction towards it
+	const hitable *pick() const
+	{
+		int index = (int)(my_rand()*lights.size());
+		if(index >= (int)lights.size())
+			index = (int)lights.size()-1;
+		return lights[index];
+	}
+
+	// the probability density of pick() choosing light and then light->random(o) returning direction v
+	// only the light that v actually reaches counts, the other lights' samples along v are blocked by it
+	// 0 if light isn't one of the lights (it is never sampled directly)
+	float pdf_value(const hitable *light, const point& o, const point& v) const
+	{
+		if(!contains(light))
+			return 0.0f;
+		return light->pdf_value(o, v) / lights.size();
+	}
+
+	bool contains(const hitable *light) const
+	{
+		for(size_t i = 0;
+			i < lights.size();
+			i++)
+		{
+			if(lights[i] == light)
+				return true;
+		}
+		return false;
+	}
+
+	std::vector<hitable *> lights;
+};
+
+// 'power heuristic' for multiple importance sampling
+// when a direction could have been picked by two sampling methods, each method's result is weighted by how likely it was to pick that direction
+// the weights for one direction always add up to 1 so the light is never counted twice
+// this keeps the best of both: light sampling for small lights, scatter() sampling for big lights and shiny materials
+inline float mis_weight(float pdf, float other_pdf)
+{
+	float a = pdf*pdf;
+	float b = other_pdf*other_pdf;
+	return (a + b) > 0.0f ? a / (a + b) : 0.0f;
+}
+
+#endif
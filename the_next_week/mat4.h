@@ -0,0 +1,202 @@
+#ifndef MAT4H
+#define MAT4H
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include <float.h>
+#include <math.h>
+
+// a 4x4 matrix for placing objects in the scene (the general version in small_examples/mat4.h never got finished)
+// only affine transforms are used (rotate, scale, translate and combinations of them), so the bottom row is always 0 0 0 1
+// and only the top 3 rows are stored: a rotate/scale part in the first 3 columns and the translation in the last
+// points are column vectors: transform_point(a*b, p) applies b first and then a, so a chain of transforms can be put together
+// once when the scene is built, e.g. mat4_translation(offset) * mat4_rotation_y(angle) * mat4_scaling(size)
+class mat4
+{
+public:
+	mat4() {}
+	inline float operator()(int row, int col) const { return m[row][col]; }
+	inline float& operator()(int row, int col) { return m[row][col]; }
+
+	float m[3][4];
+};
+
+inline mat4 mat4_identity()
+{
+	mat4 result;
+	for(int row = 0;
+		row < 3;
+		row++)
+	{
+		for(int col = 0;
+			col < 4;
+			col++)
+		{
+			result.m[row][col] = row == col ? 1.0f : 0.0f;
+		}
+	}
+	return result;
+}
+
+inline mat4 mat4_translation(const point& offset)
+{
+	mat4 result = mat4_identity();
+	result.m[0][3] = offset.x();
+	result.m[1][3] = offset.y();
+	result.m[2][3] = offset.z();
+	return result;
+}
+
+inline mat4 mat4_scaling(const point& scale)
+{
+	mat4 result = mat4_identity();
+	result.m[0][0] = scale.x();
+	result.m[1][1] = scale.y();
+	result.m[2][2] = scale.z();
+	return result;
+}
+
+// rotations are counter clockwise looking down the axis towards the origin, angle is in degrees
+// mat4_rotation_y turns things the same way as the rotate_y wrapper in hitable.h
+inline mat4 mat4_rotation_x(float angle)
+{
+	float radians = (M_PI / 180.) * angle;
+	float s = sin(radians);
+	float c = cos(radians);
+	mat4 result = mat4_identity();
+	result.m[1][1] = c;
+	result.m[1][2] = -s;
+	result.m[2][1] = s;
+	result.m[2][2] = c;
+	return result;
+}
+
+inline mat4 mat4_rotation_y(float angle)
+{
+	float radians = (M_PI / 180.) * angle;
+	float s = sin(radians);
+	float c = cos(radians);
+	mat4 result = mat4_identity();
+	result.m[0][0] = c;
+	result.m[0][2] = s;
+	result.m[2][0] = -s;
+	result.m[2][2] = c;
+	return result;
+}
+
+inline mat4 mat4_rotation_z(float angle)
+{
+	float radians = (M_PI / 180.) * angle;
+	float s = sin(radians);
+	float c = cos(radians);
+	mat4 result = mat4_identity();
+	result.m[0][0] = c;
+	result.m[0][1] = -s;
+	result.m[1][0] = s;
+	result.m[1][1] = c;
+	return result;
+}
+
+// b's missing bottom row is 0 0 0 1, so only the translation column picks up a's translation
+inline mat4 operator*(const mat4& a, const mat4& b)
+{
+	mat4 result;
+	for(int row = 0;
+		row < 3;
+		row++)
+	{
+		for(int col = 0;
+			col < 4;
+			col++)
+		{
+			result.m[row][col] = a.m[row][0]*b.m[0][col] + a.m[row][1]*b.m[1][col] + a.m[row][2]*b.m[2][col];
+		}
+		result.m[row][3] += a.m[row][3];
+	}
+	return result;
+}
+
+// the inverse of an affine transform: for p' = A*p + t the inverse is p = A^-1*p' - A^-1*t
+// so only the top left 3x3 part needs a real inverse, which is done with the cofactors
+// a matrix that squashes everything flat (a scale of 0) has no inverse, the result is then full of infs/nans
+inline mat4 mat4_affine_inverse(const mat4& a)
+{
+	const float (*m)[4] = a.m;
+	float c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+	float c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+	float c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+	float determinant = m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02;
+	float inverse_determinant = 1.0f / determinant;
+
+	mat4 result = mat4_identity();
+	result.m[0][0] = c00 * inverse_determinant;
+	result.m[1][0] = c01 * inverse_determinant;
+	result.m[2][0] = c02 * inverse_determinant;
+	result.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inverse_determinant;
+	result.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inverse_determinant;
+	result.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inverse_determinant;
+	result.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inverse_determinant;
+	result.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inverse_determinant;
+	result.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inverse_determinant;
+	for(int row = 0;
+		row < 3;
+		row++)
+	{
+		result.m[row][3] = -(result.m[row][0]*m[0][3] + result.m[row][1]*m[1][3] + result.m[row][2]*m[2][3]);
+	}
+	return result;
+}
+
+inline point transform_point(const mat4& a, const point& p)
+{
+	return point(a.m[0][0]*p.x() + a.m[0][1]*p.y() + a.m[0][2]*p.z() + a.m[0][3],
+				 a.m[1][0]*p.x() + a.m[1][1]*p.y() + a.m[1][2]*p.z() + a.m[1][3],
+				 a.m[2][0]*p.x() + a.m[2][1]*p.y() + a.m[2][2]*p.z() + a.m[2][3]);
+}
+
+// directions aren't moved by the translation part
+inline point transform_vector(const mat4& a, const point& v)
+{
+	return point(a.m[0][0]*v.x() + a.m[0][1]*v.y() + a.m[0][2]*v.z(),
+				 a.m[1][0]*v.x() + a.m[1][1]*v.y() + a.m[1][2]*v.z(),
+				 a.m[2][0]*v.x() + a.m[2][1]*v.y() + a.m[2][2]*v.z());
+}
+
+// normals have to stay at right angles to the surface, which a non uniform scale would break if they were transformed like directions
+// the fix is to transform them by the transpose of the inverse, so this takes the inverse of the transform that is being applied
+// the result isn't unit length
+inline point transform_normal(const mat4& inverse, const point& n)
+{
+	return point(inverse.m[0][0]*n.x() + inverse.m[1][0]*n.y() + inverse.m[2][0]*n.z(),
+				 inverse.m[0][1]*n.x() + inverse.m[1][1]*n.y() + inverse.m[2][1]*n.z(),
+				 inverse.m[0][2]*n.x() + inverse.m[1][2]*n.y() + inverse.m[2][2]*n.z());
+}
+
+// the box around all 8 transformed corners of b
+inline aabb transform_box(const mat4& a, const aabb& b)
+{
+	point min(FLT_MAX, FLT_MAX, FLT_MAX);
+	point max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(int corner = 0;
+		corner < 8;
+		corner++)
+	{
+		point p((corner & 1) ? b.max().x() : b.min().x(),
+				(corner & 2) ? b.max().y() : b.min().y(),
+				(corner & 4) ? b.max().z() : b.min().z());
+		point q = transform_point(a, p);
+		for(int c = 0;
+			c < 3;
+			c++)
+		{
+			if(q[c] < min[c])
+				min[c] = q[c];
+			if(q[c] > max[c])
+				max[c] = q[c];
+		}
+	}
+	return aabb(min, max);
+}
+
+#endif
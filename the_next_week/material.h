@@ -11,6 +11,16 @@ public:
 	virtual bool scatter(const ray& r_in, const hit_record& rec, rgb& attenuation, ray& scattered) const = 0;
 	// emitted is used by light sources to 'emit' light, should be overridden by light sources
 	virtual rgb emitted(float u, float v, const point& p) const { return rgb(0.0, 0.0, 0.0); }
+	// true for light sources, objects with an emissive material get added to the scene's light list (see lights.h)
+	virtual bool is_emissive() const { return false; }
+
+	// the following are used for light sampling
+	// specular materials (mirrors, glass) scatter in a single direction, so a randomly picked direction towards a light will never match it
+	// only non-specular materials are lit by sampling lights directly
+	virtual bool is_specular() const { return true; }
+	// the probability density (per unit solid angle) of scatter() picking the direction of scattered
+	// for non-specular materials, attenuation*scattering_pdf is the amount of light that is reflected from the direction of scattered towards r_in
+	virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const { return 0.0f; }
 };
 
 point reflect(const point& v, const point& normal)
@@ -79,13 +89,22 @@ public:
 		// target is the point the ray will bounce to, it is calculated by:
 		// take the hitpoint
 		// add the tangent (which is a unit vector) to get a point that is 1 magnitude away from the surface of the sphere and perpendicular to the surface
-		// add a random point on a unit circle
-		point target = rec.hit_point + rec.normal + random_in_unit_sphere();
+		// add a random point on the surface of a unit sphere
+		// using a point on the surface (rather than inside) of the sphere makes the directions follow a cosine distribution exactly, which scattering_pdf relies on
+		point target = rec.hit_point + rec.normal + random_unit_vector();
 		scattered = ray(rec.hit_point, target-rec.hit_point, r_in.time());
 		attenuation = albedo->value(rec.u,rec.v,rec.hit_point);
 		return true;
 	}
 
+	virtual bool is_specular() const { return false; }
+	// directions are picked with a probability proportional to the cosine of the angle to the normal: cos(theta)/pi
+	virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const
+	{
+		float cosine = dot(rec.normal, unit_vector(scattered.direction()));
+		return cosine < 0 ? 0 : cosine/M_PI;
+	}
+
 	texture *albedo;
 };
 
@@ -187,6 +206,7 @@ public:
 	{
 		return emit->value(u, v, p);
 	}
+	virtual bool is_emissive() const { return true; }
 
 	texture *emit;
 };
@@ -197,11 +217,18 @@ public:
 	isotropic(texture *a) : albedo(a) {}
 	virtual bool scatter(const ray& r_in, const hit_record& rec, rgb& attenuation, ray& scattered) const
 	{
-		scattered = ray(rec.hit_point, random_in_unit_sphere());
+		scattered = ray(rec.hit_point, random_in_unit_sphere(), r_in.time());
 		attenuation = albedo->value(rec.u, rec.v, rec.hit_point);
 		return true;
 	}
 
+	virtual bool is_specular() const { return false; }
+	// every direction is equally likely, the pdf is 1 / (surface area of a unit sphere)
+	virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const
+	{
+		return 1.0f / (4*M_PI);
+	}
+
 	texture *albedo;
 };
 
@@ -0,0 +1,475 @@
+#ifndef MESHH
+#define MESHH
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+#include "bvh.h"
+#include "trace.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// a mesh of triangles stored as flat arrays: every vertex once in positions, and 3 indices into it per triangle
+// there is no hitable per triangle, the whole mesh is one hitable with its own bvh over its triangles
+// the bvh uses the same 32 byte linear_bvh_node and traversal as linear_bvh (see bvh.h), with the triangle test inlined in the leaves
+// ----
+// normals and texture co-ordinates are optional and have their own index arrays, because obj files index them separately from positions
+// an index of -1 means the triangle has no normal/uv for that corner, the flat normal of the triangle and its barycentric co-ordinates are used instead
+class triangle_mesh : public hitable
+{
+public:
+	triangle_mesh(material *m) : mat_ptr(m) {}
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& b) const
+	{
+		b = box;
+		return !nodes.empty();
+	}
+	virtual void finalize(const ray& r, hit_record& rec) const;
+
+	int triangle_count() const { return (int)position_index.size() / 3; }
+	// builds the bvh, call once after the triangles have been added (triangles get reordered to match the bvh's leaves)
+	void build(int max_leaf_size = 4);
+	// sets box from the bvh's root node, for meshes whose nodes were copied in (see scene_file.h) instead of built
+	void update_box()
+	{
+		box = aabb(point(nodes[0].box_min[0], nodes[0].box_min[1], nodes[0].box_min[2]),
+				   point(nodes[0].box_max[0], nodes[0].box_max[1], nodes[0].box_max[2]));
+	}
+
+	std::vector<point> positions;
+	std::vector<point> normals;
+	std::vector<float> uvs;					// 2 floats per texture co-ordinate
+	std::vector<int32_t> position_index;	// 3 per triangle
+	std::vector<int32_t> normal_index;		// 3 per triangle, or empty if the mesh has no normals
+	std::vector<int32_t> uv_index;			// 3 per triangle, or empty if the mesh has no texture co-ordinates
+	std::vector<linear_bvh_node> nodes;
+	material *mat_ptr;
+	aabb box;
+
+private:
+	// moller-trumbore ray/triangle test, on a hit between t_min and t_max sets t and the barycentric co-ordinates of the hit (b1 for the second corner, b2 for the third)
+	bool intersect(int triangle, const ray& r, float t_min, float t_max, float& t, float& b1, float& b2) const;
+};
+
+// moller-trumbore: the point on the triangle (p0, p1, p2) with barycentric co-ordinates (b1, b2) is p0 + b1*(p1-p0) + b2*(p2-p0)
+// setting that equal to the ray A + t*B gives 3 equations for the 3 unknowns t, b1 and b2, which are solved with cramer's rule
+// the hit is inside the triangle when b1 >= 0, b2 >= 0 and b1 + b2 <= 1
+bool triangle_mesh::intersect(int triangle, const ray& r, float t_min, float t_max, float& t, float& b1, float& b2) const
+{
+	RT_STAT(primitive_tests);
+	const int32_t *index = &position_index[3*triangle];
+	const point& p0 = positions[index[0]];
+	point edge1 = positions[index[1]] - p0;
+	point edge2 = positions[index[2]] - p0;
+	point pvec = cross(r.B, edge2);
+	float determinant = dot(edge1, pvec);
+	// a determinant of 0 means the ray is parallel to the triangle
+	if(fabs(determinant) < 1e-12f)
+		return false;
+	float inverse_determinant = 1.0f / determinant;
+	point tvec = r.A - p0;
+	b1 = dot(tvec, pvec) * inverse_determinant;
+	if(b1 < 0.0f || b1 > 1.0f)
+		return false;
+	point qvec = cross(tvec, edge1);
+	b2 = dot(r.B, qvec) * inverse_determinant;
+	if(b2 < 0.0f || b1 + b2 > 1.0f)
+		return false;
+	t = dot(edge2, qvec) * inverse_determinant;
+	return t > t_min && t < t_max;
+}
+
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	if(nodes.empty())
+		return false;
+	return linear_bvh_closest_hit(&nodes[0], r, t_min, t_max, [&](int first, int count, float& closest_so_far)
+	{
+		bool hit_anything = false;
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			float t, b1, b2;
+			if(intersect(i, r, t_min, closest_so_far, t, b1, b2))
+			{
+				hit_anything = true;
+				closest_so_far = t;
+				rec.t = t;
+				rec.obj = this;
+				rec.prim = i;
+				// the barycentric co-ordinates are kept in u and v until finalize() replaces them with the real texture co-ordinates
+				rec.u = b1;
+				rec.v = b2;
+			}
+		}
+		return hit_anything;
+	});
+}
+
+bool triangle_mesh::occluded(const ray& r, float t_min, float t_max) const
+{
+	if(nodes.empty())
+		return false;
+	return linear_bvh_any_hit(&nodes[0], r, t_min, t_max, [&](int first, int count)
+	{
+		for(int i = first;
+			i < first + count;
+			i++)
+		{
+			float t, b1, b2;
+			if(intersect(i, r, t_min, t_max, t, b1, b2))
+				return true;
+		}
+		return false;
+	});
+}
+
+void triangle_mesh::finalize(const ray& r, hit_record& rec) const
+{
+	int triangle = rec.prim;
+	float b1 = rec.u;
+	float b2 = rec.v;
+	float b0 = 1.0f - b1 - b2;
+	rec.hit_point = r.point_at_parameter(rec.t);
+	rec.mat_ptr = mat_ptr;
+
+	const int32_t *p = &position_index[3*triangle];
+	const int32_t *n = normal_index.empty() ? NULL : &normal_index[3*triangle];
+	if(n && n[0] >= 0 && n[1] >= 0 && n[2] >= 0)
+	{
+		// smooth shading, the normals at the corners are blended across the triangle
+		rec.normal = unit_vector(b0*normals[n[0]] + b1*normals[n[1]] + b2*normals[n[2]]);
+	}
+	else
+	{
+		// the corners are in counter clockwise order when looking at the front of the triangle (the obj convention), so this points out of the front
+		rec.normal = unit_vector(cross(positions[p[1]] - positions[p[0]], positions[p[2]] - positions[p[0]]));
+	}
+
+	const int32_t *t = uv_index.empty() ? NULL : &uv_index[3*triangle];
+	if(t && t[0] >= 0 && t[1] >= 0 && t[2] >= 0)
+	{
+		rec.u = b0*uvs[2*t[0]] + b1*uvs[2*t[1]] + b2*uvs[2*t[2]];
+		rec.v = b0*uvs[2*t[0]+1] + b1*uvs[2*t[1]+1] + b2*uvs[2*t[2]+1];
+	}
+	// otherwise u and v are left as the barycentric co-ordinates
+}
+
+void triangle_mesh::build(int max_leaf_size)
+{
+	TRACE_SCOPE("mesh bvh build");
+	nodes.clear();
+	int n = triangle_count();
+	if(n == 0)
+		return;
+
+	bvh_build_prim *prims = new bvh_build_prim[n];
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		const int32_t *index = &position_index[3*i];
+		point lo = positions[index[0]];
+		point hi = lo;
+		for(int c = 1;
+			c < 3;
+			c++)
+		{
+			const point& v = positions[index[c]];
+			lo = point(fmin(lo.x(), v.x()), fmin(lo.y(), v.y()), fmin(lo.z(), v.z()));
+			hi = point(fmax(hi.x(), v.x()), fmax(hi.y(), v.y()), fmax(hi.z(), v.z()));
+		}
+		prims[i].box = aabb(lo, hi);
+		prims[i].centroid = 0.5f*(lo + hi);
+		prims[i].index = i;
+	}
+	// a mesh with n triangles has at most 2n-1 nodes
+	nodes.reserve(2*n);
+	linear_bvh_build(nodes, prims, n, 0, max_leaf_size);
+	update_box();
+
+	// the partitioning shuffled prims so every leaf's triangles are next to each other, put the triangles themselves in the same order
+	// so a leaf can refer to its triangles as one range
+	std::vector<int32_t> old_position_index = position_index;
+	std::vector<int32_t> old_normal_index = normal_index;
+	std::vector<int32_t> old_uv_index = uv_index;
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		for(int c = 0;
+			c < 3;
+			c++)
+		{
+			position_index[3*i+c] = old_position_index[3*prims[i].index+c];
+			if(!normal_index.empty())
+				normal_index[3*i+c] = old_normal_index[3*prims[i].index+c];
+			if(!uv_index.empty())
+				uv_index[3*i+c] = old_uv_index[3*prims[i].index+c];
+		}
+	}
+	delete[] prims;
+}
+
+// reads one index of an obj face corner, obj indices start at 1 and negative indices count back from the last one read so far
+// returns -1 if there is no index
+int obj_index(const char *s, int count)
+{
+	if(*s == '\0' || *s == '/' || *s == ' ')
+		return -1;
+	int i = atoi(s);
+	if(i > 0)
+		return i - 1;
+	if(i < 0)
+		return count + i;
+	return -1;
+}
+
+// reads one line of f into line, however long it is, line ends up NUL terminated with the '\n' left on (if there was one)
+// returns false at the end of the file
+bool read_obj_line(FILE *f, std::vector<char>& line)
+{
+	line.clear();
+	char chunk[1024];
+	while(fgets(chunk, sizeof(chunk), f))
+	{
+		size_t length = strlen(chunk);
+		line.insert(line.end(), chunk, chunk + length);
+		// fgets stops early when the line doesn't fit in chunk, keep going until the end of the line
+		if(length > 0 && chunk[length-1] == '\n')
+			break;
+	}
+	if(line.empty())
+		return false;
+	line.push_back('\0');
+	return true;
+}
+
+// reads the triangles of a wavefront obj file into mesh's arrays, the bvh isn't built
+// the file is read one line at a time and everything goes straight into the mesh's arrays, so there is no object per triangle
+// supports v, vt, vn and f (polygons are split into triangles as a fan), everything else (materials, groups, etc.) is skipped
+// returns false if the file can't be opened, has a v, vn, vt or f line that doesn't parse, or has no triangles
+bool read_obj(const char *file_name, triangle_mesh *mesh)
+{
+	TRACE_SCOPE("read_obj");
+	FILE *f = fopen(file_name, "rb");
+	if(!f)
+	{
+		printf("couldn't open %s\n", file_name);
+		return false;
+	}
+
+	bool any_normals = false;
+	bool any_uvs = false;
+	std::vector<int32_t> corner_position, corner_normal, corner_uv;
+	std::vector<char> buffer;
+	int line_number = 0;
+	bool ok = true;
+	while(ok && read_obj_line(f, buffer))
+	{
+		char *line = &buffer[0];
+		line_number++;
+		if(line[0] == 'v' && line[1] == ' ')
+		{
+			float x = 0, y = 0, z = 0;
+			if(sscanf(line+2, "%f %f %f", &x, &y, &z) != 3)
+			{
+				printf("%s:%d: a vertex needs 3 numbers\n", file_name, line_number);
+				ok = false;
+			}
+			mesh->positions.push_back(point(x, y, z));
+		}
+		else if(line[0] == 'v' && line[1] == 'n' && line[2] == ' ')
+		{
+			float x = 0, y = 0, z = 0;
+			if(sscanf(line+3, "%f %f %f", &x, &y, &z) != 3)
+			{
+				printf("%s:%d: a normal needs 3 numbers\n", file_name, line_number);
+				ok = false;
+			}
+			mesh->normals.push_back(point(x, y, z));
+		}
+		else if(line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+		{
+			// v is optional, 1d texture coordinates only have a u
+			float u = 0, v = 0;
+			if(sscanf(line+3, "%f %f", &u, &v) < 1)
+			{
+				printf("%s:%d: a texture coordinate needs at least 1 number\n", file_name, line_number);
+				ok = false;
+			}
+			mesh->uvs.push_back(u);
+			mesh->uvs.push_back(v);
+		}
+		else if(line[0] == 'f' && line[1] == ' ')
+		{
+			// every corner is 'p', 'p/t', 'p//n' or 'p/t/n'
+			corner_position.clear();
+			corner_normal.clear();
+			corner_uv.clear();
+			char *s = line+1;
+			for(;;)
+			{
+				while(*s == ' ' || *s == '\t')
+					s++;
+				if(*s == '\0' || *s == '\r' || *s == '\n')
+					break;
+				int p = obj_index(s, (int)mesh->positions.size());
+				if(p < 0)
+				{
+					printf("%s:%d: face corner %d has no valid vertex index\n", file_name, line_number, (int)corner_position.size()+1);
+					ok = false;
+					break;
+				}
+				int t = -1;
+				int n = -1;
+				while(*s && *s != '/' && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+					s++;
+				if(*s == '/')
+				{
+					s++;
+					t = obj_index(s, (int)mesh->uvs.size()/2);
+					while(*s && *s != '/' && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+						s++;
+					if(*s == '/')
+					{
+						s++;
+						n = obj_index(s, (int)mesh->normals.size());
+						while(*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+							s++;
+					}
+				}
+				corner_position.push_back(p);
+				corner_uv.push_back(t);
+				corner_normal.push_back(n);
+			}
+
+			for(size_t c = 2;
+				c < corner_position.size();
+				c++)
+			{
+				size_t fan[3] = { 0, c-1, c };
+				for(int k = 0;
+					k < 3;
+					k++)
+				{
+					mesh->position_index.push_back(corner_position[fan[k]]);
+					mesh->normal_index.push_back(corner_normal[fan[k]]);
+					mesh->uv_index.push_back(corner_uv[fan[k]]);
+					any_normals = any_normals || corner_normal[fan[k]] >= 0;
+					any_uvs = any_uvs || corner_uv[fan[k]] >= 0;
+				}
+			}
+		}
+	}
+	fclose(f);
+	if(!ok)
+		return false;
+
+	// faces that point at vertices that don't exist are dropped rather than read out of bounds later
+	int positions = (int)mesh->positions.size();
+	size_t kept = 0;
+	for(size_t i = 0;
+		i + 2 < mesh->position_index.size();
+		i += 3)
+	{
+		int32_t *index = &mesh->position_index[i];
+		if(index[0] < 0 || index[0] >= positions || index[1] < 0 || index[1] >= positions || index[2] < 0 || index[2] >= positions)
+			continue;
+		for(int k = 0;
+			k < 3;
+			k++)
+		{
+			mesh->position_index[kept+k] = mesh->position_index[i+k];
+			int32_t n = mesh->normal_index[i+k];
+			int32_t t = mesh->uv_index[i+k];
+			mesh->normal_index[kept+k] = (n < (int)mesh->normals.size()) ? n : -1;
+			mesh->uv_index[kept+k] = (t < (int)mesh->uvs.size()/2) ? t : -1;
+		}
+		kept += 3;
+	}
+	mesh->position_index.resize(kept);
+	mesh->normal_index.resize(kept);
+	mesh->uv_index.resize(kept);
+	// don't keep index arrays that are all -1
+	if(!any_normals)
+		std::vector<int32_t>().swap(mesh->normal_index);
+	if(!any_uvs)
+		std::vector<int32_t>().swap(mesh->uv_index);
+
+	if(mesh->triangle_count() == 0)
+	{
+		printf("no triangles in %s\n", file_name);
+		return false;
+	}
+	return true;
+}
+
+// reads an obj file (see read_obj()) and builds its bvh, returns NULL if it couldn't be read
+triangle_mesh *load_obj(scene_arena& arena, const char *file_name, material *m)
+{
+	triangle_mesh *mesh = arena.make<triangle_mesh>(m);
+	if(!read_obj(file_name, mesh))
+		return NULL;
+	mesh->build();
+	return mesh;
+}
+
+// a sphere made of triangles with bumps on it, so there is something to render (and benchmark) without an obj file
+// rings*segments*2 triangles
+triangle_mesh *make_bumpy_sphere(scene_arena& arena, int rings, int segments, float radius, material *m)
+{
+	triangle_mesh *mesh = arena.make<triangle_mesh>(m);
+	for(int i = 0;
+		i <= rings;
+		i++)
+	{
+		float theta = M_PI * i / rings;
+		for(int j = 0;
+			j <= segments;
+			j++)
+		{
+			float phi = 2 * M_PI * j / segments;
+			point direction(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi));
+			float bump = 1.0f + 0.05f*sin(12*theta)*sin(12*phi);
+			mesh->positions.push_back(radius*bump*direction);
+			mesh->uvs.push_back((float)j / segments);
+			mesh->uvs.push_back(1.0f - (float)i / rings);
+		}
+	}
+	for(int i = 0;
+		i < rings;
+		i++)
+	{
+		for(int j = 0;
+			j < segments;
+			j++)
+		{
+			int a = i*(segments+1) + j;
+			int b = a + segments+1;
+			// counter clockwise seen from outside the sphere
+			int quad[6] = { a, a+1, b, a+1, b+1, b };
+			for(int k = 0;
+				k < 6;
+				k++)
+			{
+				mesh->position_index.push_back(quad[k]);
+				mesh->uv_index.push_back(quad[k]);
+			}
+		}
+	}
+	mesh->build();
+	return mesh;
+}
+
+#endif
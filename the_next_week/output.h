@@ -0,0 +1,125 @@
+#ifndef OUTPUTH
+#define OUTPUTH
+
+#include "framebuffer.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma warning(push, 0) // disable compiler warnings
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "3rd_party/stb_image_write.h"
+#pragma warning(pop) // restore compiler warnings
+
+// writes the framebuffer to disk, the file format is picked from the file extension:
+//   .ppm  binary ppm (P6), 8 bits per channel
+//   .png  png through stb_image_write, 8 bits per channel
+//   .pfm  portable float map, the raw linear 32 bit floats with no gamma correction or clamping (for comparing renders or post processing)
+// all of these are written straight from the framebuffer in one pass
+
+// converts a linear color component to an 8 bit value
+// we must apply 'gamma correction' to the output to make sure dark/light shades look ok on monitors
+// we are using 'gamma 2', which means rgb values need to be to the power of 1/gamma, which with gamma=2 means square root
+inline unsigned char to_byte(float linear)
+{
+	int value = (int)(255.99*sqrt(linear));
+	if(value < 0) value = 0;
+	if(value > 255) value = 255;  // light sources can produce values above 1
+	return (unsigned char)value;
+}
+
+// 8 bit gamma corrected rgb, starting with the top row of the image (the order ppm and png want)
+// the caller frees the returned memory
+unsigned char *framebuffer_to_bytes(const framebuffer& fb)
+{
+	TRACE_SCOPE("framebuffer_to_bytes");
+	unsigned char *bytes = (unsigned char *)malloc(3*fb.width*fb.height);
+	unsigned char *out = bytes;
+	for(int j = fb.height-1;
+		j >= 0;
+		j--)
+	{
+		for(int i = 0;
+			i < fb.width;
+			i++)
+		{
+			rgb pixel = fb.get(i, j);
+			*out++ = to_byte(pixel[0]);
+			*out++ = to_byte(pixel[1]);
+			*out++ = to_byte(pixel[2]);
+		}
+	}
+	return bytes;
+}
+
+bool write_ppm(const framebuffer& fb, const char *file_name)
+{
+	FILE *f = fopen(file_name, "wb");
+	if(!f)
+		return false;
+	unsigned char *bytes = framebuffer_to_bytes(fb);
+	size_t size = 3*(size_t)fb.width*fb.height;
+	fprintf(f, "P6\n%d %d\n255\n", fb.width, fb.height);
+	bool ok = fwrite(bytes, 1, size, f) == size;
+	fclose(f);
+	free(bytes);
+	return ok;
+}
+
+bool write_png(const framebuffer& fb, const char *file_name)
+{
+	unsigned char *bytes = framebuffer_to_bytes(fb);
+	bool ok;
+	{
+		TRACE_SCOPE("stbi_write_png");
+		ok = stbi_write_png(file_name, fb.width, fb.height, 3, bytes, 3*fb.width) != 0;
+	}
+	free(bytes);
+	return ok;
+}
+
+// pfm stores rows from the bottom of the image up, which is the same order as the framebuffer, so the pixels can be written as they are
+// a negative scale in the header means the floats are little endian
+bool write_pfm(const framebuffer& fb, const char *file_name)
+{
+	static_assert(sizeof(rgb) == 3*sizeof(float), "write_pfm writes the framebuffer's pixels directly");
+	FILE *f = fopen(file_name, "wb");
+	if(!f)
+		return false;
+	fprintf(f, "PF\n%d %d\n-1.0\n", fb.width, fb.height);
+	size_t count = (size_t)fb.width*fb.height;
+	bool ok = fwrite(fb.pixels, sizeof(rgb), count, f) == count;
+	fclose(f);
+	return ok;
+}
+
+// returns true if file_name ends with an extension write_image() knows
+bool is_supported_image_file(const char *file_name)
+{
+	const char *extension = strrchr(file_name, '.');
+	return extension && (strcmp(extension, ".ppm") == 0 ||
+						 strcmp(extension, ".png") == 0 ||
+						 strcmp(extension, ".pfm") == 0);
+}
+
+bool write_image(const framebuffer& fb, const char *file_name)
+{
+	TRACE_SCOPE("write_image");
+	const char *extension = strrchr(file_name, '.');
+	bool ok = false;
+	if(extension && strcmp(extension, ".ppm") == 0)
+		ok = write_ppm(fb, file_name);
+	else if(extension && strcmp(extension, ".png") == 0)
+		ok = write_png(fb, file_name);
+	else if(extension && strcmp(extension, ".pfm") == 0)
+		ok = write_pfm(fb, file_name);
+	else
+		printf("don't know how to write %s, use .ppm, .png or .pfm\n", file_name);
+
+	if(!ok)
+		printf("writing %s failed\n", file_name);
+	return ok;
+}
+
+#endif
@@ -7,15 +7,33 @@ class ray
 {
 public:
 	ray() {}
-	ray(const point& a, const point& b, float ti = 0.0) { A = a; B = b; _time = ti; }
+	ray(const point& a, const point& b, float ti = 0.0) { A = a; B = b; _time = ti; compute_inverse(); }
 	point origin() const	{ return A; }
 	point direction() const	{ return B; }
 	float time() const 		{ return _time; }
 	point point_at_parameter(float t) const { return A + t*B; }
 
+	// 1/direction and which way the direction points on each axis, used by every slab (box) test the ray goes through
+	// they are worked out once here instead of once per box
+	const point& inverse_direction() const { return inv_B; }
+	int sign(int axis) const { return _sign[axis]; }
+
+	// NOTE: A and B shouldn't be changed after the ray is made, make a new ray instead so inv_B and _sign stay in step
 	point A;
 	point B;
 	float _time;
+	point inv_B;
+	int _sign[3];		// 1 if B points in the negative direction on that axis, 0 if it doesn't
+
+private:
+	void compute_inverse()
+	{
+		inv_B = point(1.0f / B.x(), 1.0f / B.y(), 1.0f / B.z());
+		// checking the inverse rather than B means a direction of -0 counts as negative, like the division does
+		_sign[0] = inv_B.x() < 0.0f;
+		_sign[1] = inv_B.y() < 0.0f;
+		_sign[2] = inv_B.z() < 0.0f;
+	}
 };
 
 #endif
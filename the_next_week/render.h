@@ -0,0 +1,294 @@
+#ifndef RENDERH
+#define RENDERH
+
+#include "vec3.h"
+#include "util.h"
+#include "camera.h"
+#include "material.h"
+#include "hitable.h"
+#include "bvh.h"
+#include "lights.h"
+#include "scheduler.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "trace.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+// hardware_concurrency() is allowed to return 0 if it can't tell how many cores there are
+int default_thread_count()
+{
+	int thread_count = (int)std::thread::hardware_concurrency();
+	if(thread_count < 1)
+		thread_count = 8;
+	return thread_count;
+}
+
+// everything that controls a render, main() fills this in from the command line
+struct render_settings
+{
+	render_settings()
+		: scene(6), nx(800), ny(400), ns(100), thread_count(default_thread_count()), tile_size(16), accel(ACCEL_BVH),
+		  max_depth(50), rr_depth(3), light_sampling(true), sphere_sets(true), obj_file(NULL), scene_file(NULL),
+		  heatmap(false), heatmap_pixels(false) {}
+	int scene;				// which case of create_scene() to render
+	int nx;					// resolution width
+	int ny;					// resolution height
+	int ns;					// number of samples per pixel
+	int thread_count;
+	int tile_size;			// width and height of a tile in pixels
+	accel_structure accel;	// what the scene's objects are put in
+	int max_depth;			// most times a path can bounce
+	int rr_depth;			// bounces before russian roulette can stop a path (see color())
+	bool light_sampling;	// send shadow rays towards the scene's lights at every bounce (see color())
+	bool sphere_sets;		// pack the scene's spheres into sphere_sets (see pack_spheres())
+	const char *obj_file;	// mesh rendered by scene 7, NULL for the generated one
+	const char *scene_file;	// scene to render instead of a case of create_scene() (see scene_file.h), NULL for none
+	bool heatmap;			// write how long each tile took next to the render (see heatmap.h)
+	bool heatmap_pixels;	// time every pixel for the heatmap instead of only every tile
+};
+
+// per thread counters, every render thread only touches its own so there is no sharing between threads
+struct worker_stats
+{
+	worker_stats() : primary_rays(0), secondary_rays(0), shadow_rays(0), tiles_rendered(0), seconds(0) {}
+	uint64_t primary_rays;		// rays sent from the camera
+	uint64_t secondary_rays;	// rays created by scatter()
+	uint64_t shadow_rays;		// rays sent towards lights
+	int tiles_rendered;
+	double seconds;				// time from the thread starting to it running out of tiles
+#ifdef RT_STATS
+	render_counters counters;	// the thread's hot path counters (see stats.h)
+#endif
+};
+
+// follows a path from the camera through the scene and returns the light that arrives along it
+// instead of recursing once per bounce, this keeps a running 'throughput' (the product of the attenuations so far)
+// light found at a bounce is scaled by the throughput of the path up to that bounce
+// ----
+// light reaches the path in two ways:
+//   -a scattered ray happens to hit a light (the only way for the original recursive version)
+//   -'next event estimation': at every non-specular bounce a shadow ray is sent towards a random point on a random light
+// both can find the same light from the same point, so each is weighted with multiple importance sampling (see mis_weight() in lights.h)
+// ----
+// 'russian roulette' is used to stop paths that can't contribute much:
+// after rr_depth bounces a path survives with probability p (based on how bright its throughput still is), and if it survives its throughput is divided by p
+// dividing by p makes up for the paths that were stopped, so the average result is the same as never stopping (it is 'unbiased') but dark paths stop early
+rgb color(const ray& r, const hitable *world, const light_list& lights, const render_settings& settings, worker_stats& stats)
+{
+	bool sample_lights = settings.light_sampling && !lights.empty();
+	rgb result(0, 0, 0);
+	rgb throughput(1, 1, 1);
+	ray current = r;
+	// pdf of the bounce that made 'current', 0 if it was specular or it is the camera ray
+	float scatter_pdf = 0.0f;
+	for(int depth = 0;
+		;
+		depth++)
+	{
+		hit_record rec;
+		// some of the reflected rays will hit the same object they are bouncing off of at very small values for t because of floating point imprecision
+		// using 0.001 as the t_min helps prevent that
+		if(!world->hit(current, 0.001, FLT_MAX, rec)) // rec is an output of this function
+		{
+			// ray didn't hit any objects, the background is black
+			/*
+			point unit_direction = unit_vector(current.direction());
+			float t = 0.5*(unit_direction.y() + 1.0); // maps the y component to scalar between 0 and 1
+			// produces rgb value that ranges from (0.5, 0.7, 1.0) to (1, 1, 1)
+			result += throughput*((1.0-t)*rgb(1.0, 1.0, 1.0) + t*rgb(0.5, 0.7, 1.0));
+			*/
+			RT_STAT_PATH_ENDED(depth);
+			break;
+		}
+		// hit() only found which object is closest, this fills in the hit point, normal, uv and material
+		// finalize_hit() clears rec.obj, so the object that was hit is kept for the light pdf below
+		const hitable *hit_object = rec.obj;
+		finalize_hit(current, rec);
+
+		if(rec.mat_ptr->is_emissive())
+		{
+			rgb emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.hit_point); // TODO don't think I have changed every object to set a rec.u and rec.v
+			if(sample_lights && scatter_pdf > 0.0f)
+			{
+				// the previous bounce could also have found this light with next event estimation
+				float light_pdf = lights.pdf_value(hit_object, current.origin(), current.direction());
+				emitted *= mis_weight(scatter_pdf, light_pdf);
+			}
+			result += throughput*emitted;
+		}
+
+		ray scattered;
+		rgb attenuation;
+		// stop when the path is too long or a non scattering material (a light) is hit
+		if(depth >= settings.max_depth || !rec.mat_ptr->scatter(current, rec, attenuation, scattered)) // attenuation and scattered are outputs
+		{
+			RT_STAT_PATH_ENDED(depth);
+			break;
+		}
+
+		scatter_pdf = 0.0f;
+		if(sample_lights && !rec.mat_ptr->is_specular())
+		{
+			scatter_pdf = rec.mat_ptr->scattering_pdf(current, rec, scattered);
+
+			// next event estimation
+			// pick a point on a light, then check nothing is in the way between the hit point and that point
+			const hitable *light = lights.pick();
+			ray to_light(rec.hit_point, light->random(rec.hit_point), current.time());
+			hit_record light_rec;
+			if(light->hit(to_light, 0.001, FLT_MAX, light_rec))
+			{
+				float light_pdf = lights.pdf_value(light, to_light.origin(), to_light.direction());
+				float material_pdf = rec.mat_ptr->scattering_pdf(current, rec, to_light);
+				// stopping just short of the light so the light itself doesn't count as blocking the ray
+				stats.shadow_rays++;
+				if(light_pdf > 0.0f && material_pdf > 0.0f &&
+				   !world->occluded(to_light, 0.001, light_rec.t*0.9999f))
+				{
+					// attenuation*material_pdf is how much of the light coming from the light's direction is reflected along the path
+					finalize_hit(to_light, light_rec);
+					rgb emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.hit_point);
+					float weight = mis_weight(light_pdf, material_pdf);
+					result += throughput*attenuation*emitted*(material_pdf*weight/light_pdf);
+				}
+			}
+		}
+		throughput *= attenuation;
+
+		if(depth+1 >= settings.rr_depth)
+		{
+			float survive = fmax(throughput[0], fmax(throughput[1], throughput[2]));
+			if(survive < 0.95f)
+			{
+				if(my_rand() >= survive)
+				{
+					RT_STAT_PATH_ENDED(depth);
+					break;
+				}
+				throughput /= survive;
+			}
+		}
+
+		stats.secondary_rays++;
+		current = scattered;
+	}
+	return result;
+}
+
+// renders every pixel in the tile and stores the averaged linear color in the framebuffer
+// tiles never overlap so the render threads can write into the framebuffer without any locking
+// timings is NULL unless the time of each pixel is wanted
+void render_tile(const tile& t, const render_settings& settings, const hitable *world, const light_list& lights, const camera& cam, framebuffer *fb, worker_stats& stats,
+				 render_timings *timings)
+{
+	// each tile gets its own random sequence, so the image comes out the same no matter which thread renders which tile
+	thread_rng().seed(0x853c49e6748fea9bULL, (uint64_t)t.index);
+	for (int j = t.y1-1;
+		j >= t.y0;
+		j--)
+	{
+		for (int i = t.x0;
+			i < t.x1;
+			i++)
+		{
+			std::chrono::steady_clock::time_point pixel_start;
+			if(timings)
+				pixel_start = std::chrono::steady_clock::now();
+			// sampling
+			rgb pixel(0, 0, 0);
+			for (int s = 0;
+				s < settings.ns;
+				s++)
+			{
+				// i+my_rand() gives random values in the range: i <= val < (i+1)
+				float u = (float)(i+my_rand()) / (float)fb->width;
+				float v = (float)(j+my_rand()) / (float)fb->height;
+				// u and v are used as randomized points on the image plane that always fall within the boundaries of the pixel
+				// this is for anti-aliasing to smooth out pixelated edges and sharp color boundaries in the final image
+				ray r = cam.get_ray(u, v);
+				stats.primary_rays++;
+				pixel += color(r, world, lights, settings, stats);
+			}
+			pixel /= (float)(settings.ns);  // average of the color values of all the samples
+			// gamma correction is applied when the framebuffer is written out
+			fb->set(i, j, pixel);
+			if(timings)
+				timings->set_pixel(i, j, (float)std::chrono::duration<double>(std::chrono::steady_clock::now() - pixel_start).count());
+		}
+	}
+	stats.tiles_rendered++;
+}
+
+// each render thread runs this, it keeps taking tiles from the scheduler (stealing from other threads when its own tiles run out) until there are none left
+void render_worker(tile_scheduler *scheduler, int worker, const render_settings *settings, const hitable *world, const light_list *lights, const camera *cam, framebuffer *fb, worker_stats *stats,
+				   render_timings *timings)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#ifdef RT_STATS
+	thread_counters().clear();
+#endif
+	trace_thread_name("render " + std::to_string(worker));
+	tile t;
+	while(scheduler->next_tile(worker, t))
+	{
+		TRACE_SCOPE("tile", t.index);
+		if(timings)
+		{
+			std::chrono::steady_clock::time_point tile_start = std::chrono::steady_clock::now();
+			render_tile(t, *settings, world, *lights, *cam, fb, *stats, timings->times_pixels() ? timings : NULL);
+			timings->set_tile(t, worker, std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count());
+		}
+		else
+		{
+			render_tile(t, *settings, world, *lights, *cam, fb, *stats, NULL);
+		}
+	}
+	stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#ifdef RT_STATS
+	stats->counters = thread_counters();
+#endif
+}
+
+// renders the whole image into fb using settings.thread_count threads
+// the image size comes from fb, not settings
+// stats gets one entry per thread
+// timings records how long each tile took when it isn't NULL, it has to be made with the same size and tile_size as the render (see heatmap.h)
+void render_image(const hitable *world, const light_list& lights, const camera& cam, const render_settings& settings, framebuffer *fb, std::vector<worker_stats>& stats,
+				  render_timings *timings = NULL)
+{
+	TRACE_SCOPE("render_image");
+	int thread_count = settings.thread_count;
+	tile_scheduler scheduler(fb->width, fb->height, settings.tile_size, thread_count);
+	stats.assign(thread_count, worker_stats());
+
+	std::vector<std::thread> threads;
+	for(int i = 0;
+		i < thread_count;
+		i++)
+	{
+		threads.push_back(std::thread(render_worker,
+									  &scheduler,
+									  i,
+									  &settings,
+									  world,
+									  &lights,
+									  &cam,
+									  fb,
+									  &stats[i],
+									  timings));
+	}
+
+	for(int i = 0;
+		i < thread_count;
+		i++)
+	{
+		threads[i].join();
+	}
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef RNGH
+#define RNGH
+
+#include <stdint.h>
+
+// PCG32 random number generator (see pcg-random.org by Melissa O'Neill)
+// the state is a 64 bit linear congruential generator, the output is a permuted version of the top bits of the state
+// it is small (16 bytes), fast, has good statistical quality and supports 2^63 independent streams which we use to give each tile its own sequence
+class rng
+{
+public:
+	rng() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+	rng(uint64_t initial_state, uint64_t stream) { seed(initial_state, stream); }
+
+	// stream selects which of the independent sequences the generator produces
+	void seed(uint64_t initial_state, uint64_t stream)
+	{
+		state = 0;
+		inc = (stream << 1) | 1;  // the increment must be odd
+		next_u32();
+		state += initial_state;
+		next_u32();
+	}
+
+	uint32_t next_u32()
+	{
+		uint64_t old_state = state;
+		state = old_state*6364136223846793005ULL + inc;
+		uint32_t xorshifted = (uint32_t)(((old_state >> 18) ^ old_state) >> 27);
+		uint32_t rot = (uint32_t)(old_state >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((0u-rot) & 31));
+	}
+
+	// returns random floats in the range: 0 <= val < 1
+	// the top 24 bits are used since that is all the precision a float has, this gives 2^24 evenly spaced values
+	float next_float()
+	{
+		return (float)(next_u32() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+// every thread has its own generator, so there is no locking and no shared cache lines between the render threads
+// (rand() takes a global lock on some C runtimes which serializes every render thread)
+// the render code re-seeds it at the start of every tile so the image doesn't depend on which thread rendered which tile
+inline rng& thread_rng()
+{
+	static thread_local rng generator;
+	return generator;
+}
+
+#endif
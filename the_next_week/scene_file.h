@@ -0,0 +1,1078 @@
+#ifndef SCENEFILEH
+#define SCENEFILEH
+
+#include "vec3.h"
+#include "camera.h"
+#include "textures.h"
+#include "material.h"
+#include "hitable.h"
+#include "bvh.h"
+#include "lights.h"
+#include "mesh.h"
+#include "instance.h"
+#include "mat4.h"
+#include "arena.h"
+#include "scenes.h"
+#include "render.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// scenes described in a file instead of a case in create_scene()
+// there are two forms of the same thing:
+// - a text file that is easy to write by hand (the format is below)
+// - a compiled binary file made from a text file with 'main -scene-file <text file> -compile <binary file>'
+//   it is the flat records the text is turned into, written straight to disk, and is loaded by memory mapping it and building the
+//   scene directly from the mapped records, so there is nothing to parse; meshes are stored with their bvh already built
+// the loader tells them apart by the first bytes of the file
+// ----
+// the text format has one thing per line, '#' starts a comment, and names can't contain spaces
+// render settings (the command line overrides these):
+//   size <nx> <ny>
+//   spp <samples per pixel>
+//   max_depth <n>
+//   rr_depth <n>
+//   light_sampling <0|1>
+//   sphere_sets <0|1>
+//   accel <list|bvh|bvh4>
+// the camera (required):
+//   camera <lookfrom x y z> <lookat x y z> <up x y z> <vertical fov> <aperture> <focus distance> <time0> <time1>
+// textures:
+//   texture <name> constant <r g b>
+//   texture <name> checker <texture> <texture>
+//   texture <name> noise <scale>
+//   texture <name> image <file>
+// materials:
+//   material <name> lambertian <texture>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <refractive index>
+//   material <name> diffuse_light <texture>
+//   material <name> isotropic <texture>
+// objects, a name of '-' is an object that isn't referred to again:
+//   sphere <name> <center x y z> <radius> <material>
+//   moving_sphere <name> <center0 x y z> <center1 x y z> <time0> <time1> <radius> <material>
+//   xy_rect <name> <x0> <x1> <y0> <y1> <z> <material>
+//   xz_rect <name> <x0> <x1> <z0> <z1> <y> <material>
+//   yz_rect <name> <y0> <y1> <z0> <z1> <x> <material>
+//   box <name> <min x y z> <max x y z> <material>
+//   mesh <name> <obj file> <material>
+//   flip_normals <name> <object>
+//   transform <name> <object> followed by any number of: translate <x y z> | rotate_x <degrees> | rotate_y <degrees> | rotate_z <degrees> | scale <x y z>
+//     (applied in the order they are written, one object can be transformed any number of times and is only stored once, see instance.h)
+//   constant_medium <name> <boundary object> <density> <material>
+// every object is in the scene unless it is used by a later flip_normals, transform or constant_medium
+// textures, materials and objects have to be defined before they are used
+
+// ----
+// the records, these are the same in memory and in the compiled file (which is why they only hold fixed size types)
+// references to other textures/materials/objects/meshes are indices into their arrays, strings are offsets into the string table
+// the compiled file is written in the byte order of the machine that wrote it
+
+enum scene_texture_type
+{
+	SCENE_TEXTURE_CONSTANT,
+	SCENE_TEXTURE_CHECKER,
+	SCENE_TEXTURE_NOISE,
+	SCENE_TEXTURE_IMAGE,
+};
+
+struct scene_texture_record
+{
+	int32_t type;
+	int32_t texture[2];		// checker
+	int32_t file;			// image, offset into the string table
+	float value[4];			// constant: r g b, noise: scale
+};
+
+enum scene_material_type
+{
+	SCENE_MATERIAL_LAMBERTIAN,
+	SCENE_MATERIAL_METAL,
+	SCENE_MATERIAL_DIELECTRIC,
+	SCENE_MATERIAL_DIFFUSE_LIGHT,
+	SCENE_MATERIAL_ISOTROPIC,
+};
+
+struct scene_material_record
+{
+	int32_t type;
+	int32_t texture;		// lambertian, diffuse_light, isotropic
+	float value[4];			// metal: r g b fuzz, dielectric: refractive index
+};
+
+enum scene_object_type
+{
+	SCENE_OBJECT_SPHERE,
+	SCENE_OBJECT_MOVING_SPHERE,
+	SCENE_OBJECT_XY_RECT,
+	SCENE_OBJECT_XZ_RECT,
+	SCENE_OBJECT_YZ_RECT,
+	SCENE_OBJECT_BOX,
+	SCENE_OBJECT_MESH,
+	SCENE_OBJECT_FLIP_NORMALS,
+	SCENE_OBJECT_TRANSFORM,
+	SCENE_OBJECT_CONSTANT_MEDIUM,
+};
+
+struct scene_object_record
+{
+	int32_t type;
+	int32_t material;
+	int32_t object;			// mesh: index into the meshes, wrappers: the wrapped object (always an earlier one)
+	int32_t in_world;		// 0 if a later object uses this one
+	float value[12];		// the numbers from the text in order, transform: the top 3 rows of its mat4
+};
+
+// a mesh's arrays (see triangle_mesh) are stored one after another in the data blob, starting at offset
+struct scene_mesh_record
+{
+	uint64_t offset;
+	int32_t position_count;
+	int32_t normal_count;
+	int32_t uv_count;
+	int32_t triangle_count;
+	int32_t node_count;
+	int32_t has_normal_index;
+	int32_t has_uv_index;
+	int32_t pad;
+};
+
+struct scene_camera_record
+{
+	float lookfrom[3];
+	float lookat[3];
+	float up[3];
+	float vfov;
+	float aperture;
+	float focus_distance;
+	float time0;
+	float time1;
+};
+
+// -1 for settings the file doesn't set
+struct scene_settings_record
+{
+	int32_t nx;
+	int32_t ny;
+	int32_t ns;
+	int32_t max_depth;
+	int32_t rr_depth;
+	int32_t light_sampling;
+	int32_t sphere_sets;
+	int32_t accel;
+};
+
+// the start of a compiled file, the sections follow at the given offsets from the start of the file
+struct scene_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	scene_camera_record camera;
+	scene_settings_record settings;
+	uint32_t texture_count;
+	uint32_t material_count;
+	uint32_t object_count;
+	uint32_t mesh_count;
+	uint64_t string_bytes;
+	uint64_t blob_bytes;
+	uint64_t texture_offset;
+	uint64_t material_offset;
+	uint64_t object_offset;
+	uint64_t mesh_offset;
+	uint64_t string_offset;
+	uint64_t blob_offset;
+};
+
+static const char SCENE_FILE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+static const uint32_t SCENE_FILE_VERSION = 1;
+
+// everything a scene is built from, pointing either into scene_file's arrays (text files) or into the mapped file (compiled files)
+struct scene_view
+{
+	scene_camera_record camera;
+	scene_settings_record settings;
+	const scene_texture_record *textures;
+	const scene_material_record *materials;
+	const scene_object_record *objects;
+	const scene_mesh_record *meshes;
+	const char *strings;
+	const uint8_t *blob;
+	int texture_count;
+	int material_count;
+	int object_count;
+	int mesh_count;
+	uint64_t string_bytes;
+	uint64_t blob_bytes;
+};
+
+// a read only view of a whole file that the os pages in as it is read
+class mapped_file
+{
+public:
+	mapped_file() : data(NULL), size(0)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+	~mapped_file() { close(); }
+	bool open(const char *file_name);
+	void close();
+
+	const uint8_t *data;
+	size_t size;
+
+private:
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+};
+
+bool mapped_file::open(const char *file_name)
+{
+	close();
+#ifdef _WIN32
+	file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping)
+	{
+		close();
+		return false;
+	}
+	data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!data)
+	{
+		close();
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(file_name, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void *memory = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file open by itself
+	::close(fd);
+	if(memory == MAP_FAILED)
+		return false;
+	data = (const uint8_t *)memory;
+	size = (size_t)file_stat.st_size;
+#endif
+	return true;
+}
+
+void mapped_file::close()
+{
+#ifdef _WIN32
+	if(data)
+		UnmapViewOfFile(data);
+	if(mapping)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if(data)
+		munmap((void *)data, size);
+#endif
+	data = NULL;
+	size = 0;
+}
+
+// a loaded scene file, either form
+class scene_file
+{
+public:
+	// returns false (after printing why) if the file can't be read or has a mistake in it
+	bool load(const char *file_name);
+	bool save_compiled(const char *file_name) const;
+	scene_view view;
+
+private:
+	bool load_text(const char *file_name);
+	bool load_compiled(const char *file_name);
+	void update_view();
+
+	std::vector<scene_texture_record> textures;
+	std::vector<scene_material_record> materials;
+	std::vector<scene_object_record> objects;
+	std::vector<scene_mesh_record> meshes;
+	std::vector<char> strings;
+	std::vector<uint8_t> blob;
+	mapped_file mapping;
+};
+
+bool scene_file::load(const char *file_name)
+{
+	TRACE_SCOPE("load scene file");
+	FILE *f = fopen(file_name, "rb");
+	if(!f)
+	{
+		printf("couldn't open %s\n", file_name);
+		return false;
+	}
+	char magic[8] = {};
+	size_t read = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+	if(read == sizeof(magic) && memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0)
+		return load_compiled(file_name);
+	return load_text(file_name);
+}
+
+void scene_file::update_view()
+{
+	view.textures = textures.empty() ? NULL : &textures[0];
+	view.materials = materials.empty() ? NULL : &materials[0];
+	view.objects = objects.empty() ? NULL : &objects[0];
+	view.meshes = meshes.empty() ? NULL : &meshes[0];
+	view.strings = strings.empty() ? NULL : &strings[0];
+	view.blob = blob.empty() ? NULL : &blob[0];
+	view.texture_count = (int)textures.size();
+	view.material_count = (int)materials.size();
+	view.object_count = (int)objects.size();
+	view.mesh_count = (int)meshes.size();
+	view.string_bytes = strings.size();
+	view.blob_bytes = blob.size();
+}
+
+// appends count items to the blob, the blob stays a multiple of 4 bytes long because everything in it is made of 4 byte values
+template<typename T>
+void append_to_blob(std::vector<uint8_t>& blob, const T *items, size_t count)
+{
+	if(count == 0)
+		return;
+	size_t start = blob.size();
+	blob.resize(start + count*sizeof(T));
+	memcpy(&blob[start], items, count*sizeof(T));
+}
+
+// the text parser, one line at a time
+// every function returns false and prints where the mistake is when the line doesn't make sense
+struct scene_text_parser
+{
+	const char *file_name;
+	int line_number;
+	char *tokens[64];
+	int token_count;
+	std::map<std::string, int> texture_names;
+	std::map<std::string, int> material_names;
+	std::map<std::string, int> object_names;
+
+	bool error(const char *message, const char *detail = "")
+	{
+		printf("%s:%d: %s%s\n", file_name, line_number, message, detail);
+		return false;
+	}
+
+	// splits line into tokens at spaces and tabs, stopping at a '#'
+	void split(char *line)
+	{
+		token_count = 0;
+		char *s = line;
+		for(;;)
+		{
+			while(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+				s++;
+			if(*s == '\0' || *s == '#' || token_count == 64)
+				break;
+			tokens[token_count++] = s;
+			while(*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+				s++;
+			if(*s)
+				*s++ = '\0';
+		}
+	}
+
+	bool expect(int count)
+	{
+		if(token_count != count)
+			return error("wrong number of values for ", tokens[0]);
+		return true;
+	}
+
+	bool read_float(int token, float& f)
+	{
+		char *end;
+		f = strtof(tokens[token], &end);
+		if(end == tokens[token] || *end != '\0')
+			return error("not a number: ", tokens[token]);
+		return true;
+	}
+
+	bool read_floats(int first, int count, float *f)
+	{
+		for(int i = 0;
+			i < count;
+			i++)
+		{
+			if(!read_float(first + i, f[i]))
+				return false;
+		}
+		return true;
+	}
+
+	bool read_int(int token, int32_t& i)
+	{
+		char *end;
+		i = (int32_t)strtol(tokens[token], &end, 10);
+		if(end == tokens[token] || *end != '\0')
+			return error("not a whole number: ", tokens[token]);
+		return true;
+	}
+
+	bool find(std::map<std::string, int>& names, int token, const char *kind, int32_t& index)
+	{
+		std::map<std::string, int>::const_iterator it = names.find(tokens[token]);
+		if(it == names.end())
+		{
+			printf("%s:%d: unknown %s: %s\n", file_name, line_number, kind, tokens[token]);
+			return false;
+		}
+		index = it->second;
+		return true;
+	}
+
+	bool define(std::map<std::string, int>& names, int token, int index)
+	{
+		if(strcmp(tokens[token], "-") == 0)
+			return true;
+		if(names.count(tokens[token]))
+			return error("name already used: ", tokens[token]);
+		names[tokens[token]] = index;
+		return true;
+	}
+};
+
+bool scene_file::load_text(const char *file_name)
+{
+	FILE *f = fopen(file_name, "rb");
+	if(!f)
+	{
+		printf("couldn't open %s\n", file_name);
+		return false;
+	}
+	scene_text_parser parser;
+	parser.file_name = file_name;
+	parser.line_number = 0;
+	scene_settings_record settings = { -1, -1, -1, -1, -1, -1, -1, -1 };
+	bool have_camera = false;
+	bool ok = true;
+	char line[1024];
+	while(ok && fgets(line, sizeof(line), f))
+	{
+		parser.line_number++;
+		parser.split(line);
+		if(parser.token_count == 0)
+			continue;
+		char **t = parser.tokens;
+		const char *keyword = t[0];
+
+		if(strcmp(keyword, "size") == 0)
+		{
+			ok = parser.expect(3) && parser.read_int(1, settings.nx) && parser.read_int(2, settings.ny);
+		}
+		else if(strcmp(keyword, "spp") == 0)
+		{
+			ok = parser.expect(2) && parser.read_int(1, settings.ns);
+		}
+		else if(strcmp(keyword, "max_depth") == 0)
+		{
+			ok = parser.expect(2) && parser.read_int(1, settings.max_depth);
+		}
+		else if(strcmp(keyword, "rr_depth") == 0)
+		{
+			ok = parser.expect(2) && parser.read_int(1, settings.rr_depth);
+		}
+		else if(strcmp(keyword, "light_sampling") == 0)
+		{
+			ok = parser.expect(2) && parser.read_int(1, settings.light_sampling);
+		}
+		else if(strcmp(keyword, "sphere_sets") == 0)
+		{
+			ok = parser.expect(2) && parser.read_int(1, settings.sphere_sets);
+		}
+		else if(strcmp(keyword, "accel") == 0)
+		{
+			accel_structure accel;
+			ok = parser.expect(2);
+			if(ok && !parse_accel(t[1], accel))
+				ok = parser.error("unknown acceleration structure: ", t[1]);
+			if(ok)
+				settings.accel = accel;
+		}
+		else if(strcmp(keyword, "camera") == 0)
+		{
+			scene_camera_record& c = view.camera;
+			ok = parser.expect(15) &&
+				 parser.read_floats(1, 3, c.lookfrom) && parser.read_floats(4, 3, c.lookat) && parser.read_floats(7, 3, c.up) &&
+				 parser.read_float(10, c.vfov) && parser.read_float(11, c.aperture) && parser.read_float(12, c.focus_distance) &&
+				 parser.read_float(13, c.time0) && parser.read_float(14, c.time1);
+			have_camera = true;
+		}
+		else if(strcmp(keyword, "texture") == 0)
+		{
+			scene_texture_record r;
+			memset(&r, 0, sizeof(r));
+			ok = parser.token_count >= 3 && parser.define(parser.texture_names, 1, (int)textures.size());
+			if(!ok)
+			{
+				if(parser.token_count < 3)
+					parser.error("wrong number of values for ", keyword);
+			}
+			else if(strcmp(t[2], "constant") == 0)
+			{
+				r.type = SCENE_TEXTURE_CONSTANT;
+				ok = parser.expect(6) && parser.read_floats(3, 3, r.value);
+			}
+			else if(strcmp(t[2], "checker") == 0)
+			{
+				r.type = SCENE_TEXTURE_CHECKER;
+				ok = parser.expect(5) && parser.find(parser.texture_names, 3, "texture", r.texture[0]) && parser.find(parser.texture_names, 4, "texture", r.texture[1]);
+			}
+			else if(strcmp(t[2], "noise") == 0)
+			{
+				r.type = SCENE_TEXTURE_NOISE;
+				ok = parser.expect(4) && parser.read_float(3, r.value[0]);
+			}
+			else if(strcmp(t[2], "image") == 0)
+			{
+				r.type = SCENE_TEXTURE_IMAGE;
+				ok = parser.expect(4);
+				if(ok)
+				{
+					r.file = (int32_t)strings.size();
+					strings.insert(strings.end(), t[3], t[3] + strlen(t[3]) + 1);
+				}
+			}
+			else
+			{
+				ok = parser.error("unknown texture type: ", t[2]);
+			}
+			textures.push_back(r);
+		}
+		else if(strcmp(keyword, "material") == 0)
+		{
+			scene_material_record r;
+			memset(&r, 0, sizeof(r));
+			ok = parser.token_count >= 3 && parser.define(parser.material_names, 1, (int)materials.size());
+			if(!ok)
+			{
+				if(parser.token_count < 3)
+					parser.error("wrong number of values for ", keyword);
+			}
+			else if(strcmp(t[2], "lambertian") == 0 || strcmp(t[2], "diffuse_light") == 0 || strcmp(t[2], "isotropic") == 0)
+			{
+				r.type = strcmp(t[2], "lambertian") == 0 ? SCENE_MATERIAL_LAMBERTIAN : (strcmp(t[2], "diffuse_light") == 0 ? SCENE_MATERIAL_DIFFUSE_LIGHT : SCENE_MATERIAL_ISOTROPIC);
+				ok = parser.expect(4) && parser.find(parser.texture_names, 3, "texture", r.texture);
+			}
+			else if(strcmp(t[2], "metal") == 0)
+			{
+				r.type = SCENE_MATERIAL_METAL;
+				ok = parser.expect(7) && parser.read_floats(3, 4, r.value);
+			}
+			else if(strcmp(t[2], "dielectric") == 0)
+			{
+				r.type = SCENE_MATERIAL_DIELECTRIC;
+				ok = parser.expect(4) && parser.read_float(3, r.value[0]);
+			}
+			else
+			{
+				ok = parser.error("unknown material type: ", t[2]);
+			}
+			materials.push_back(r);
+		}
+		else
+		{
+			// everything else is an object: <type> <name> <values...> and then a material or another object
+			scene_object_record r;
+			memset(&r, 0, sizeof(r));
+			r.in_world = 1;
+			r.material = -1;
+			r.object = -1;
+			// the number of values between the name and the material for the simple shapes
+			int value_count = -1;
+			if(strcmp(keyword, "sphere") == 0)				{ r.type = SCENE_OBJECT_SPHERE;			value_count = 4; }
+			else if(strcmp(keyword, "moving_sphere") == 0)	{ r.type = SCENE_OBJECT_MOVING_SPHERE;	value_count = 9; }
+			else if(strcmp(keyword, "xy_rect") == 0)		{ r.type = SCENE_OBJECT_XY_RECT;		value_count = 5; }
+			else if(strcmp(keyword, "xz_rect") == 0)		{ r.type = SCENE_OBJECT_XZ_RECT;		value_count = 5; }
+			else if(strcmp(keyword, "yz_rect") == 0)		{ r.type = SCENE_OBJECT_YZ_RECT;		value_count = 5; }
+			else if(strcmp(keyword, "box") == 0)			{ r.type = SCENE_OBJECT_BOX;			value_count = 6; }
+			else if(strcmp(keyword, "mesh") == 0)			r.type = SCENE_OBJECT_MESH;
+			else if(strcmp(keyword, "flip_normals") == 0)	r.type = SCENE_OBJECT_FLIP_NORMALS;
+			else if(strcmp(keyword, "transform") == 0)		r.type = SCENE_OBJECT_TRANSFORM;
+			else if(strcmp(keyword, "constant_medium") == 0)	r.type = SCENE_OBJECT_CONSTANT_MEDIUM;
+			else
+			{
+				ok = parser.error("unknown keyword: ", keyword);
+				break;
+			}
+			ok = parser.token_count >= 3 && parser.define(parser.object_names, 1, (int)objects.size());
+			if(!ok)
+			{
+				if(parser.token_count < 3)
+					parser.error("wrong number of values for ", keyword);
+			}
+			else if(value_count >= 0)
+			{
+				ok = parser.expect(3 + value_count) && parser.read_floats(2, value_count, r.value) &&
+					 parser.find(parser.material_names, 2 + value_count, "material", r.material);
+			}
+			else if(r.type == SCENE_OBJECT_MESH)
+			{
+				ok = parser.expect(4) && parser.find(parser.material_names, 3, "material", r.material);
+				// the mesh is read and its bvh built now, the compiled file then has it ready to use
+				triangle_mesh mesh(NULL);
+				if(ok && !read_obj(t[2], &mesh))
+					ok = parser.error("couldn't read mesh ", t[2]);
+				if(ok)
+				{
+					mesh.build();
+					scene_mesh_record m;
+					memset(&m, 0, sizeof(m));
+					m.offset = blob.size();
+					m.position_count = (int32_t)mesh.positions.size();
+					m.normal_count = (int32_t)mesh.normals.size();
+					m.uv_count = (int32_t)mesh.uvs.size() / 2;
+					m.triangle_count = mesh.triangle_count();
+					m.node_count = (int32_t)mesh.nodes.size();
+					m.has_normal_index = !mesh.normal_index.empty();
+					m.has_uv_index = !mesh.uv_index.empty();
+					append_to_blob(blob, mesh.positions.empty() ? NULL : &mesh.positions[0], mesh.positions.size());
+					append_to_blob(blob, mesh.normals.empty() ? NULL : &mesh.normals[0], mesh.normals.size());
+					append_to_blob(blob, mesh.uvs.empty() ? NULL : &mesh.uvs[0], mesh.uvs.size());
+					append_to_blob(blob, &mesh.position_index[0], mesh.position_index.size());
+					append_to_blob(blob, mesh.normal_index.empty() ? NULL : &mesh.normal_index[0], mesh.normal_index.size());
+					append_to_blob(blob, mesh.uv_index.empty() ? NULL : &mesh.uv_index[0], mesh.uv_index.size());
+					append_to_blob(blob, &mesh.nodes[0], mesh.nodes.size());
+					r.object = (int32_t)meshes.size();
+					meshes.push_back(m);
+				}
+			}
+			else if(r.type == SCENE_OBJECT_FLIP_NORMALS)
+			{
+				ok = parser.expect(3) && parser.find(parser.object_names, 2, "object", r.object);
+			}
+			else if(r.type == SCENE_OBJECT_CONSTANT_MEDIUM)
+			{
+				ok = parser.expect(5) && parser.find(parser.object_names, 2, "object", r.object) && parser.read_float(3, r.value[0]) &&
+					 parser.find(parser.material_names, 4, "material", r.material);
+			}
+			else if(r.type == SCENE_OBJECT_TRANSFORM)
+			{
+				ok = parser.find(parser.object_names, 2, "object", r.object);
+				mat4 m = mat4_identity();
+				int i = 3;
+				while(ok && i < parser.token_count)
+				{
+					float v[3];
+					if(strcmp(t[i], "translate") == 0 && i+3 < parser.token_count && parser.read_floats(i+1, 3, v))
+					{
+						m = mat4_translation(point(v[0], v[1], v[2])) * m;
+						i += 4;
+					}
+					else if(strcmp(t[i], "scale") == 0 && i+3 < parser.token_count && parser.read_floats(i+1, 3, v))
+					{
+						m = mat4_scaling(point(v[0], v[1], v[2])) * m;
+						i += 4;
+					}
+					else if(strncmp(t[i], "rotate_", 7) == 0 && i+1 < parser.token_count && parser.read_float(i+1, v[0]))
+					{
+						if(strcmp(t[i], "rotate_x") == 0)
+							m = mat4_rotation_x(v[0]) * m;
+						else if(strcmp(t[i], "rotate_y") == 0)
+							m = mat4_rotation_y(v[0]) * m;
+						else if(strcmp(t[i], "rotate_z") == 0)
+							m = mat4_rotation_z(v[0]) * m;
+						else
+							ok = parser.error("unknown transform: ", t[i]);
+						i += 2;
+					}
+					else
+					{
+						ok = parser.error("can't read transform: ", t[i]);
+					}
+				}
+				memcpy(r.value, m.m, sizeof(m.m));
+			}
+			// a wrapped object is only drawn through the wrapper
+			if(ok && r.type >= SCENE_OBJECT_FLIP_NORMALS)
+				objects[r.object].in_world = 0;
+			objects.push_back(r);
+		}
+	}
+	fclose(f);
+	if(ok && !have_camera)
+	{
+		printf("%s: no camera\n", file_name);
+		ok = false;
+	}
+	view.settings = settings;
+	update_view();
+	return ok;
+}
+
+bool scene_file::load_compiled(const char *file_name)
+{
+	if(!mapping.open(file_name))
+	{
+		printf("couldn't map %s\n", file_name);
+		return false;
+	}
+	if(mapping.size < sizeof(scene_file_header))
+	{
+		printf("%s is too small to be a compiled scene\n", file_name);
+		return false;
+	}
+	const scene_file_header *header = (const scene_file_header *)mapping.data;
+	if(header->version != SCENE_FILE_VERSION || header->header_size != sizeof(scene_file_header))
+	{
+		printf("%s was compiled by a different version\n", file_name);
+		return false;
+	}
+	// every section has to be inside the file
+	struct section { uint64_t offset; uint64_t bytes; };
+	const section sections[6] =
+	{
+		{ header->texture_offset, header->texture_count * (uint64_t)sizeof(scene_texture_record) },
+		{ header->material_offset, header->material_count * (uint64_t)sizeof(scene_material_record) },
+		{ header->object_offset, header->object_count * (uint64_t)sizeof(scene_object_record) },
+		{ header->mesh_offset, header->mesh_count * (uint64_t)sizeof(scene_mesh_record) },
+		{ header->string_offset, header->string_bytes },
+		{ header->blob_offset, header->blob_bytes },
+	};
+	for(int i = 0;
+		i < 6;
+		i++)
+	{
+		if(sections[i].offset > mapping.size || sections[i].bytes > mapping.size - sections[i].offset)
+		{
+			printf("%s is cut short or damaged\n", file_name);
+			return false;
+		}
+	}
+	// the text parser only accepts the accel names, anything else here is damage
+	if(header->settings.accel < -1 || header->settings.accel > ACCEL_BVH4)
+	{
+		printf("%s is damaged, it has an unknown accel\n", file_name);
+		return false;
+	}
+	view.camera = header->camera;
+	view.settings = header->settings;
+	view.textures = (const scene_texture_record *)(mapping.data + header->texture_offset);
+	view.materials = (const scene_material_record *)(mapping.data + header->material_offset);
+	view.objects = (const scene_object_record *)(mapping.data + header->object_offset);
+	view.meshes = (const scene_mesh_record *)(mapping.data + header->mesh_offset);
+	view.strings = (const char *)(mapping.data + header->string_offset);
+	view.blob = mapping.data + header->blob_offset;
+	view.texture_count = (int)header->texture_count;
+	view.material_count = (int)header->material_count;
+	view.object_count = (int)header->object_count;
+	view.mesh_count = (int)header->mesh_count;
+	view.string_bytes = header->string_bytes;
+	view.blob_bytes = header->blob_bytes;
+	return true;
+}
+
+// writes the header and then each section at the next multiple of 16 bytes, so the records are aligned when the file is mapped
+bool scene_file::save_compiled(const char *file_name) const
+{
+	FILE *f = fopen(file_name, "wb");
+	if(!f)
+	{
+		printf("couldn't write %s\n", file_name);
+		return false;
+	}
+	scene_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_FILE_VERSION;
+	header.header_size = sizeof(scene_file_header);
+	header.camera = view.camera;
+	header.settings = view.settings;
+	header.texture_count = view.texture_count;
+	header.material_count = view.material_count;
+	header.object_count = view.object_count;
+	header.mesh_count = view.mesh_count;
+	header.string_bytes = view.string_bytes;
+	header.blob_bytes = view.blob_bytes;
+
+	const void *data[6] = { view.textures, view.materials, view.objects, view.meshes, view.strings, view.blob };
+	uint64_t bytes[6] =
+	{
+		view.texture_count * (uint64_t)sizeof(scene_texture_record),
+		view.material_count * (uint64_t)sizeof(scene_material_record),
+		view.object_count * (uint64_t)sizeof(scene_object_record),
+		view.mesh_count * (uint64_t)sizeof(scene_mesh_record),
+		view.string_bytes,
+		view.blob_bytes,
+	};
+	uint64_t *offsets[6] = { &header.texture_offset, &header.material_offset, &header.object_offset, &header.mesh_offset, &header.string_offset, &header.blob_offset };
+	uint64_t offset = sizeof(header);
+	for(int i = 0;
+		i < 6;
+		i++)
+	{
+		offset = (offset + 15) & ~(uint64_t)15;
+		*offsets[i] = offset;
+		offset += bytes[i];
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	uint64_t written = sizeof(header);
+	const char zeros[16] = {};
+	for(int i = 0;
+		i < 6 && ok;
+		i++)
+	{
+		if(*offsets[i] > written)
+			ok = fwrite(zeros, 1, (size_t)(*offsets[i] - written), f) == *offsets[i] - written;
+		if(ok && bytes[i] > 0)
+			ok = fwrite(data[i], 1, (size_t)bytes[i], f) == bytes[i];
+		written = *offsets[i] + bytes[i];
+	}
+	if(fclose(f) != 0)
+		ok = false;
+	if(!ok)
+		printf("couldn't write %s\n", file_name);
+	return ok;
+}
+
+// copies the settings the file sets into settings, load() has checked they are in range
+void apply_scene_settings(const scene_view& scene, render_settings& settings)
+{
+	const scene_settings_record& s = scene.settings;
+	if(s.nx > 0)				settings.nx = s.nx;
+	if(s.ny > 0)				settings.ny = s.ny;
+	if(s.ns > 0)				settings.ns = s.ns;
+	if(s.max_depth > 0)			settings.max_depth = s.max_depth;
+	if(s.rr_depth >= 0)			settings.rr_depth = s.rr_depth;
+	if(s.light_sampling >= 0)	settings.light_sampling = s.light_sampling != 0;
+	if(s.sphere_sets >= 0)		settings.sphere_sets = s.sphere_sets != 0;
+	if(s.accel >= 0)			settings.accel = (accel_structure)s.accel;
+}
+
+// true if every index is at least lowest and less than count
+bool indices_in_range(const std::vector<int32_t>& index, int32_t lowest, int32_t count)
+{
+	for(size_t i = 0;
+		i < index.size();
+		i++)
+	{
+		if(index[i] < lowest || index[i] >= count)
+			return false;
+	}
+	return true;
+}
+
+// makes the scene's objects in arena, the same way as a case of create_scene() would (the parameters are the same too)
+// returns NULL (after printing why) if a record refers to something that doesn't exist, which can only happen with a damaged compiled file
+// everything a record refers to is checked, including a mesh's indices and bvh nodes, so a damaged file can't make the render read
+// outside of what was loaded
+hitable *build_scene(const scene_view& scene, scene_arena& arena, camera& cam, light_list& lights, int total_nx, int total_ny, accel_structure accel, bool sphere_sets)
+{
+	TRACE_SCOPE("build_scene");
+	const scene_camera_record& c = scene.camera;
+	cam = camera(point(c.lookfrom[0], c.lookfrom[1], c.lookfrom[2]),
+				 point(c.lookat[0], c.lookat[1], c.lookat[2]),
+				 point(c.up[0], c.up[1], c.up[2]),
+				 c.vfov,
+				 (float)total_nx/(float)total_ny,
+				 c.aperture,
+				 c.focus_distance,
+				 c.time0, c.time1);
+
+	// textures can only refer to earlier textures, and objects to earlier objects
+	texture **textures = arena.make_array<texture *>(scene.texture_count);
+	for(int i = 0;
+		i < scene.texture_count;
+		i++)
+	{
+		const scene_texture_record& r = scene.textures[i];
+		const float *v = r.value;
+		textures[i] = NULL;
+		if(r.type == SCENE_TEXTURE_CONSTANT)
+			textures[i] = arena.make<constant_texture>(rgb(v[0], v[1], v[2]));
+		else if(r.type == SCENE_TEXTURE_CHECKER && r.texture[0] >= 0 && r.texture[0] < i && r.texture[1] >= 0 && r.texture[1] < i)
+			textures[i] = arena.make<checker_texture>(textures[r.texture[0]], textures[r.texture[1]]);
+		else if(r.type == SCENE_TEXTURE_NOISE)
+			textures[i] = arena.make<noise_texture>(v[0]);
+		else if(r.type == SCENE_TEXTURE_IMAGE && r.file >= 0 && (uint64_t)r.file < scene.string_bytes &&
+				memchr(scene.strings + r.file, '\0', (size_t)(scene.string_bytes - r.file)))
+		{
+			image_texture *image = arena.make<image_texture>(scene.strings + r.file);
+			if(image->valid())
+				textures[i] = image;
+			else
+				printf("couldn't load %s\n", scene.strings + r.file);
+		}
+		if(!textures[i])
+		{
+			printf("bad texture %d in scene\n", i);
+			return NULL;
+		}
+	}
+
+	material **materials = arena.make_array<material *>(scene.material_count);
+	for(int i = 0;
+		i < scene.material_count;
+		i++)
+	{
+		const scene_material_record& r = scene.materials[i];
+		const float *v = r.value;
+		bool has_texture = r.texture >= 0 && r.texture < scene.texture_count;
+		if(r.type == SCENE_MATERIAL_LAMBERTIAN && has_texture)
+			materials[i] = arena.make<lambertian>(textures[r.texture]);
+		else if(r.type == SCENE_MATERIAL_METAL)
+			materials[i] = arena.make<metal>(rgb(v[0], v[1], v[2]), v[3]);
+		else if(r.type == SCENE_MATERIAL_DIELECTRIC)
+			materials[i] = arena.make<dielectric>(v[0]);
+		else if(r.type == SCENE_MATERIAL_DIFFUSE_LIGHT && has_texture)
+			materials[i] = arena.make<diffuse_light>(textures[r.texture]);
+		else if(r.type == SCENE_MATERIAL_ISOTROPIC && has_texture)
+			materials[i] = arena.make<isotropic>(textures[r.texture]);
+		else
+		{
+			printf("bad material %d in scene\n", i);
+			return NULL;
+		}
+	}
+
+	hitable **objects = arena.make_array<hitable *>(scene.object_count);
+	hitable **list = arena.make_array<hitable *>(scene.object_count);
+	int n = 0;
+	for(int i = 0;
+		i < scene.object_count;
+		i++)
+	{
+		const scene_object_record& r = scene.objects[i];
+		const float *v = r.value;
+		material *m = (r.material >= 0 && r.material < scene.material_count) ? materials[r.material] : NULL;
+		hitable *wrapped = (r.object >= 0 && r.object < i) ? objects[r.object] : NULL;
+		objects[i] = NULL;
+		if(r.type == SCENE_OBJECT_SPHERE && m)
+			objects[i] = arena.make<sphere>(point(v[0], v[1], v[2]), v[3], m);
+		else if(r.type == SCENE_OBJECT_MOVING_SPHERE && m)
+			objects[i] = arena.make<moving_sphere>(point(v[0], v[1], v[2]), point(v[3], v[4], v[5]), v[6], v[7], v[8], m);
+		else if(r.type == SCENE_OBJECT_XY_RECT && m)
+			objects[i] = arena.make<xy_rect>(v[0], v[1], v[2], v[3], v[4], m);
+		else if(r.type == SCENE_OBJECT_XZ_RECT && m)
+			objects[i] = arena.make<xz_rect>(v[0], v[1], v[2], v[3], v[4], m);
+		else if(r.type == SCENE_OBJECT_YZ_RECT && m)
+			objects[i] = arena.make<yz_rect>(v[0], v[1], v[2], v[3], v[4], m);
+		else if(r.type == SCENE_OBJECT_BOX && m)
+			objects[i] = arena.make<box>(point(v[0], v[1], v[2]), point(v[3], v[4], v[5]), m);
+		else if(r.type == SCENE_OBJECT_MESH && m && r.object >= 0 && r.object < scene.mesh_count)
+		{
+			// the arrays are copied straight out of the blob, the bvh was built when the text was read
+			const scene_mesh_record& mr = scene.meshes[r.object];
+			uint64_t bytes = mr.position_count*(uint64_t)sizeof(point) + mr.normal_count*(uint64_t)sizeof(point) + mr.uv_count*2*(uint64_t)sizeof(float) +
+							 mr.triangle_count*3*(uint64_t)sizeof(int32_t)*(1 + (mr.has_normal_index != 0) + (mr.has_uv_index != 0)) +
+							 mr.node_count*(uint64_t)sizeof(linear_bvh_node);
+			if(mr.position_count < 0 || mr.normal_count < 0 || mr.uv_count < 0 || mr.triangle_count <= 0 || mr.node_count <= 0 ||
+			   mr.offset > scene.blob_bytes || bytes > scene.blob_bytes - mr.offset)
+			{
+				printf("bad mesh %d in scene\n", r.object);
+				return NULL;
+			}
+			triangle_mesh *mesh = arena.make<triangle_mesh>(m);
+			const uint8_t *p = scene.blob + mr.offset;
+			const point *positions = (const point *)p;
+			mesh->positions.assign(positions, positions + mr.position_count);
+			p += mr.position_count*sizeof(point);
+			const point *normals = (const point *)p;
+			mesh->normals.assign(normals, normals + mr.normal_count);
+			p += mr.normal_count*sizeof(point);
+			const float *uvs = (const float *)p;
+			mesh->uvs.assign(uvs, uvs + 2*mr.uv_count);
+			p += 2*mr.uv_count*sizeof(float);
+			const int32_t *index = (const int32_t *)p;
+			mesh->position_index.assign(index, index + 3*mr.triangle_count);
+			index += 3*mr.triangle_count;
+			if(mr.has_normal_index)
+			{
+				mesh->normal_index.assign(index, index + 3*mr.triangle_count);
+				index += 3*mr.triangle_count;
+			}
+			if(mr.has_uv_index)
+			{
+				mesh->uv_index.assign(index, index + 3*mr.triangle_count);
+				index += 3*mr.triangle_count;
+			}
+			const linear_bvh_node *nodes = (const linear_bvh_node *)index;
+			mesh->nodes.assign(nodes, nodes + mr.node_count);
+			// normals and uvs use -1 for corners that don't have one
+			if(!indices_in_range(mesh->position_index, 0, mr.position_count) ||
+			   !indices_in_range(mesh->normal_index, -1, mr.normal_count) ||
+			   !indices_in_range(mesh->uv_index, -1, mr.uv_count) ||
+			   !linear_bvh_valid(&mesh->nodes[0], mr.node_count, mr.triangle_count))
+			{
+				printf("bad mesh %d in scene\n", r.object);
+				return NULL;
+			}
+			mesh->update_box();
+			objects[i] = mesh;
+		}
+		else if(r.type == SCENE_OBJECT_FLIP_NORMALS && wrapped)
+			objects[i] = arena.make<flip_normals>(wrapped);
+		else if(r.type == SCENE_OBJECT_TRANSFORM && wrapped)
+		{
+			mat4 to_world;
+			memcpy(to_world.m, v, sizeof(to_world.m));
+			objects[i] = arena.make<instance>(wrapped, to_world);
+		}
+		else if(r.type == SCENE_OBJECT_CONSTANT_MEDIUM && wrapped && m)
+			objects[i] = arena.make<constant_medium>(wrapped, v[0], m);
+
+		if(!objects[i])
+		{
+			printf("bad object %d in scene\n", i);
+			return NULL;
+		}
+		if(r.in_world)
+			list[n++] = objects[i];
+	}
+	if(n == 0)
+	{
+		printf("the scene has no objects\n");
+		return NULL;
+	}
+	return finish_scene(arena, list, n, lights, accel, sphere_sets);
+}
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef SCENESH
+#define SCENESH
+
+#include "vec3.h"
+#include "util.h"
+#include "camera.h"
+#include "textures.h"
+#include "material.h"
+#include "hitable.h"
+#include "bvh.h"
+#include "lights.h"
+#include "sphere_set.h"
+#include "mesh.h"
+#include "instance.h"
+#include "arena.h"
+#include "trace.h"
+#include <assert.h>
+
+// finds the lights among the scene's top level objects and puts the objects in the acceleration structure
+// with sphere_sets, spheres that are close together are first packed into sphere_sets (see pack_spheres())
+hitable *finish_scene(scene_arena& arena, hitable **list, int n, light_list& lights, accel_structure accel, bool sphere_sets)
+{
+	lights.collect(list, n);
+	if(sphere_sets)
+		n = pack_spheres(arena, list, n);
+	// every scene's camera shutter is open from time 0 to 1
+	return build_accel(arena, list, n, 0.0, 1.0, accel);
+}
+
+// a triangle mesh standing on a ground plane under an area light, with the camera placed from the mesh's bounding box
+// so any mesh is in view whatever its size and position
+hitable *mesh_scene(scene_arena& arena, triangle_mesh *mesh, camera& cam, light_list& lights, int total_nx, int total_ny, accel_structure accel, bool sphere_sets)
+{
+	aabb b;
+	mesh->bounding_box(0, 1, b);
+	point center = 0.5*(b.min() + b.max());
+	float size = (b.max() - b.min()).length();
+
+	point lookfrom = center + size*point(0.3, 0.4, 1.4);
+	float dist_to_focus = 10.0;
+	float aperture = 0.0;
+	cam = camera(lookfrom, center,
+			   point(0,1,0),
+			   40,
+			   (float)total_nx/(float)total_ny,
+			   aperture,
+			   dist_to_focus,
+			   0.0, 1.0);
+
+	material *white = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.73, 0.73, 0.73)));
+	material *light = arena.make<diffuse_light>(arena.make<constant_texture>(rgb(8, 8, 8)));
+
+	hitable **list = arena.make_array<hitable *>(3);
+	int i = 0;
+	list[i++] = mesh;
+	list[i++] = arena.make<xz_rect>(center.x() - 10*size, center.x() + 10*size, center.z() - 10*size, center.z() + 10*size, b.min().y(), white);
+	list[i++] = arena.make<xz_rect>(center.x() - 0.5*size, center.x() + 0.5*size, center.z() - 0.5*size, center.z() + 0.5*size, b.max().y() + size, light);
+	return finish_scene(arena, list, i, lights, accel, sphere_sets);
+}
+
+// create_scene() has scenes 0 to SCENE_COUNT-1
+const int SCENE_COUNT = 9;
+
+// cam and lights are outputs, everything the scene is made of is allocated in arena and lives until the arena is cleared
+// accel decides what the top level objects are put in (see build_accel())
+// sphere_sets turns on packing the scene's spheres into sphere_sets
+// obj_file is the mesh scene 7 renders, a generated bumpy sphere is used when it's NULL
+// returns NULL (after printing why) when obj_file can't be read
+hitable *create_scene(int scene_num, scene_arena& arena, camera& cam, light_list& lights, int total_nx, int total_ny, accel_structure accel=ACCEL_BVH, bool sphere_sets=true,
+					  const char *obj_file=NULL)
+{
+	TRACE_SCOPE("create_scene");
+	switch(scene_num)
+	{
+	case(0):
+	{
+		point lookfrom(13.0,2.0,3.0);
+		point lookat(0.0,0.0,0.0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0.0,1.0,0.0),
+				   20,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		int n = 500;
+		hitable **list = arena.make_array<hitable *>(n+1);
+		texture *temp1 = arena.make<constant_texture>(rgb(0.2,0.3,0.1));
+		texture *temp2 = arena.make<constant_texture>(rgb(0.9,0.9,0.9));
+		texture *checker = arena.make<checker_texture>(temp1, temp2);  
+		list[0] = arena.make<sphere>(point(0.0,-1000.0,0.0), 1000, arena.make<lambertian>(checker));
+		int i = 1;
+		for(int a = -10;
+			a < 10;
+			a++)
+		{
+			for(int b = -10;
+				b < 10;
+				b++)
+			{
+				float choose_mat = my_rand();
+				point center(a+0.9*my_rand(),0.2,b+0.9*my_rand());
+				if((center-point(4.0,0.2,0.0)).length() > 0.9)
+				{
+					if(choose_mat < 0.8)
+					{
+						constant_texture *tex = arena.make<constant_texture>(rgb(my_rand()*my_rand(),
+																				 my_rand()*my_rand(),
+																				 my_rand()*my_rand())); 
+						list[i++] = arena.make<moving_sphere>(center,
+															  center+point(0.0,0.5*my_rand(),0.0),
+															  0.0, 1.0,
+															  0.2,
+															  arena.make<lambertian>(tex));
+					}
+					else if(choose_mat < 0.95)
+					{
+						list[i++] = arena.make<sphere>(center, 0.2, arena.make<metal>(rgb(0.5*(1+my_rand()),
+																					0.5*(1+my_rand()),
+																					0.5*(1+my_rand())),
+																					0.5*my_rand()));
+					}
+					else
+					{
+						list[i++] = arena.make<sphere>(center, 0.2, arena.make<dielectric>(1.5));
+					}
+				}
+			}
+		}
+
+		list[i++] = arena.make<sphere>(point(0.0,1.0,0.0), 1.0, arena.make<dielectric>(1.5));
+		list[i++] = arena.make<sphere>(point(-4.0,1.0,0.0), 1.0, arena.make<lambertian>(arena.make<constant_texture>(rgb(0.4,0.2,0.1))));
+		list[i++] = arena.make<sphere>(point(4.0,1.0,0.0), 1.0, arena.make<metal>(rgb(0.7,0.6,0.5), 0.0));
+
+		return finish_scene(arena, list, i, lights, accel, sphere_sets);
+	} break;
+	
+	case(1):
+	{
+		point lookfrom(13.0,2.0,3.0);
+		point lookat(0.0,0.0,0.0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0.0,1.0,0.0),
+				   20,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		texture *temp1 = arena.make<constant_texture>(rgb(0.2,0.3,0.1));
+		texture *temp2 = arena.make<constant_texture>(rgb(0.9,0.9,0.9));
+		texture *checker = arena.make<checker_texture>(temp1, temp2);  
+		hitable **list = arena.make_array<hitable *>(2);
+		list[0] = arena.make<sphere>(point(0.0,-10.0,0.0), 10, arena.make<lambertian>(checker));
+		list[1] = arena.make<sphere>(point(0.0,10.0,0.0), 10, arena.make<metal>(rgb(0.8,0.3,0.3), 0.02));
+
+		return finish_scene(arena, list, 2, lights, accel, sphere_sets);
+	} break;
+
+	case(2):
+	{
+		point lookfrom(13.0,2.0,3.0);
+		point lookat(0.0,0.0,0.0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0.0,1.0,0.0),
+				   20,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		texture *pertex = arena.make<noise_texture>(4);
+		hitable **list = arena.make_array<hitable *>(2);
+		list[0] = arena.make<sphere>(point(0.0,-1000.0,0.0), 1000, arena.make<lambertian>(pertex));
+		list[1] = arena.make<sphere>(point(0.0,2.0,0.0), 2, arena.make<lambertian>(pertex));
+		return finish_scene(arena, list, 2, lights, accel, sphere_sets);
+	} break;
+
+	case(3):
+	{
+		point lookfrom(13.0,2.0,3.0);
+		point lookat(0.0,0.0,0.0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0.0,1.0,0.0),
+				   20,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		// working directory when the program is ran by run.bat is r:\\the_next_week\images
+		image_texture *txtre = arena.make<image_texture>("..\\assets\\earthmap.jpg");
+		if(!txtre->valid())
+		{
+			printf("couldn't load ..\\assets\\earthmap.jpg\n");
+			return NULL;
+		}
+		hitable **list = arena.make_array<hitable *>(1);
+		list[0] = arena.make<sphere>(point(0,0,0), 1, arena.make<lambertian>(txtre));
+		return finish_scene(arena, list, 1, lights, accel, sphere_sets);
+	} break;
+
+	case(4):
+	{
+		point lookfrom(13.0,2.0,3.0);
+		point lookat(0.0,0.0,0.0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0.0,1.0,0.0),
+				   60,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		const int COUNT = 4;
+		texture *pertex = arena.make<noise_texture>(4);
+		hitable **list = arena.make_array<hitable *>(COUNT);
+		list[0] = arena.make<sphere>(point(0,-1000,0), 1000, arena.make<lambertian>(pertex));
+		list[1] = arena.make<sphere>(point(0,2,0), 2, arena.make<lambertian>(pertex));
+		// note that the rgb value for diffuse_light is above (1,1,1)
+		list[2] = arena.make<sphere>(point(0,7,0), 2, arena.make<diffuse_light>(arena.make<constant_texture>(rgb(4,4,4))));
+		list[3] = arena.make<xy_rect>(3, 5, 1, 3, -2, arena.make<diffuse_light>(arena.make<constant_texture>(rgb(4,4,4))));
+		return finish_scene(arena, list, COUNT, lights, accel, sphere_sets);
+	} break;
+
+	case(5):
+	{
+		point lookfrom(278, 278, -800);
+		point lookat(278, 278, 0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0,1,0),
+				   40,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		material *red   = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.65, 0.05, 0.05)));
+		material *white = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.73, 0.73, 0.73)));
+		material *green = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.12, 0.45, 0.15)));
+		// note that the rgb value for diffuse_light is above (1,1,1)
+		material *light = arena.make<diffuse_light>(arena.make<constant_texture>(rgb(15, 15, 15)));
+
+		hitable **list = arena.make_array<hitable *>(8);
+		int i = 0;
+
+		// background walls
+		list[i++] = arena.make<flip_normals>(arena.make<yz_rect>(0, 555, 0, 555, 555, green));
+		list[i++] = arena.make<yz_rect>(0, 555, 0, 555, 0, red);
+		list[i++] = arena.make<xz_rect>(213, 343, 227, 332, 554, light);
+		list[i++] = arena.make<flip_normals>(arena.make<xz_rect>(0, 555, 0, 555, 555, white));
+		list[i++] = arena.make<xz_rect>(0, 555, 0, 555, 0, white);
+		list[i++] = arena.make<flip_normals>(arena.make<xy_rect>(0, 555, 0, 555, 555, white));
+/*
+		// foreground boxes
+		list[i++] = arena.make<box>(point(130, 0, 65), point(295, 165, 230), white);
+		list[i++] = arena.make<box>(point(265, 0, 295), point(430, 330, 460), white);
+*/
+		// foreground boxes
+		// each box is turned and then moved into place by one instance (see instance.h) rather than a translate(rotate_y()) chain
+		hitable *short_box = arena.make<box>(point(0, 0, 0), point(165, 165, 165), white);
+		hitable *tall_box = arena.make<box>(point(0, 0, 0), point(165, 330, 165), white);
+		list[i++] = arena.make<instance>(short_box, mat4_translation(point(130,0,65)) * mat4_rotation_y(-18));
+		list[i++] = arena.make<instance>(tall_box, mat4_translation(point(265,0,295)) * mat4_rotation_y(15));
+
+		return finish_scene(arena, list, i, lights, accel, sphere_sets);
+	} break;
+
+	case(6):
+	{
+		point lookfrom(278, 278, -800);
+		point lookat(278, 278, 0);
+		float dist_to_focus = 10.0; //(lookfrom-lookat).length();
+		float aperture = 0.0; // controls how much of the image is in focus, lower number = more of the image is in focus
+		cam = camera(lookfrom, lookat,
+				   point(0,1,0),
+				   40,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		material *red   = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.65, 0.05, 0.05)));
+		material *white = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.73, 0.73, 0.73)));
+		material *green = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.12, 0.45, 0.15)));
+		// note that the rgb value for diffuse_light is above (1,1,1)
+		//material *light = arena.make<diffuse_light>(arena.make<constant_texture>(rgb(7, 7, 7)));
+		// TODO
+		material *light = arena.make<diffuse_light>(arena.make<constant_texture>(rgb(4, 4, 4)));
+
+		hitable **list = arena.make_array<hitable *>(8);
+		int i = 0;
+
+		// background walls
+		list[i++] = arena.make<flip_normals>(arena.make<yz_rect>(0, 555, 0, 555, 555, green));
+		list[i++] = arena.make<yz_rect>(0, 555, 0, 555, 0, red);
+		list[i++] = arena.make<xz_rect>(113, 443, 127, 432, 554, light);
+		list[i++] = arena.make<flip_normals>(arena.make<xz_rect>(0, 555, 0, 555, 555, white));
+		list[i++] = arena.make<xz_rect>(0, 555, 0, 555, 0, white);
+		list[i++] = arena.make<flip_normals>(arena.make<xy_rect>(0, 555, 0, 555, 555, white));
+
+		hitable *short_box = arena.make<box>(point(0,0,0), point(165,165,165), white);
+		hitable *tall_box = arena.make<box>(point(0,0,0), point(165,330,165), white);
+		hitable *b1 = arena.make<instance>(short_box, mat4_translation(point(130,0,65)) * mat4_rotation_y(-18));
+		hitable *b2 = arena.make<instance>(tall_box, mat4_translation(point(265,0,295)) * mat4_rotation_y(15));
+
+		list[i++] = arena.make<constant_medium>(b1, 0.01, arena.make<isotropic>(arena.make<constant_texture>(rgb(0.4, 0.4, 1))));
+		list[i++] = arena.make<constant_medium>(b2, 0.01, arena.make<isotropic>(arena.make<constant_texture>(rgb(0,0,0))));
+		return finish_scene(arena, list, i, lights, accel, sphere_sets);
+	} break;
+
+	case(7):
+	{
+		material *grey = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.6, 0.6, 0.6)));
+		triangle_mesh *mesh;
+		if(obj_file)
+		{
+			mesh = load_obj(arena, obj_file, grey);
+			if(!mesh)
+				return NULL;
+		}
+		else
+		{
+			mesh = make_bumpy_sphere(arena, 200, 400, 1.0, grey);
+		}
+		printf("mesh has %d triangles\n", mesh->triangle_count());
+		return mesh_scene(arena, mesh, cam, lights, total_nx, total_ny, accel, sphere_sets);
+	} break;
+
+	case(8):
+	{
+		// a forest of 10,000 trees that are all copies (instances) of one tree, so the tree's geometry and bvh only exist once
+		point lookfrom(0, 25, -230);
+		point lookat(0, 0, 0);
+		float dist_to_focus = 10.0;
+		float aperture = 0.0;
+		cam = camera(lookfrom, lookat,
+				   point(0,1,0),
+				   30,
+				   (float)total_nx/(float)total_ny,
+				   aperture,
+				   dist_to_focus,
+				   0.0, 1.0);
+
+		material *bark = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.35, 0.2, 0.1)));
+		material *leaves = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.1, 0.4, 0.1)));
+		material *ground = arena.make<lambertian>(arena.make<constant_texture>(rgb(0.4, 0.35, 0.25)));
+		material *sun = arena.make<diffuse_light>(arena.make<constant_texture>(rgb(20, 18, 15)));
+
+		// the tree is the bottom level, a trunk and a round top in their own bvh
+		hitable **tree_list = arena.make_array<hitable *>(2);
+		tree_list[0] = arena.make<box>(point(-0.3, 0, -0.3), point(0.3, 3, 0.3), bark);
+		tree_list[1] = arena.make<sphere>(point(0, 4, 0), 1.5, leaves);
+		hitable *tree = build_accel(arena, tree_list, 2, 0.0, 1.0, ACCEL_BVH);
+
+		// the top level, a 100x100 grid of trees 4 apart, each one moved, turned and scaled a bit at random
+		instance_bvh *forest = arena.make<instance_bvh>();
+		for(int a = -50;
+			a < 50;
+			a++)
+		{
+			for(int b = -50;
+				b < 50;
+				b++)
+			{
+				point position(4*a + 3*my_rand(), 0, 4*b + 3*my_rand());
+				float scale = 0.7 + 0.6*my_rand();
+				forest->add(tree, mat4_translation(position) * mat4_rotation_y(360*my_rand()) * mat4_scaling(point(scale, scale, scale)));
+			}
+		}
+		forest->build();
+		printf("forest has %d instances of one tree\n", forest->instance_count());
+
+		hitable **list = arena.make_array<hitable *>(3);
+		int i = 0;
+		list[i++] = forest;
+		list[i++] = arena.make<xz_rect>(-1000, 1000, -1000, 1000, 0, ground);
+		list[i++] = arena.make<sphere>(point(-400, 600, -300), 100, sun);
+		return finish_scene(arena, list, i, lights, accel, sphere_sets);
+	} break;
+
+	default:
+	{
+		assert(1 == 0);
+	} break;
+	}
+	return NULL;
+}
+
+#endif
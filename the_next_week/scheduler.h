@@ -0,0 +1,113 @@
+#ifndef SCHEDULERH
+#define SCHEDULERH
+
+#include <mutex>
+#include <deque>
+#include <vector>
+
+// a tile is a small rectangle of the image, it is the unit of work that gets handed to the render threads
+// x0/y0 are inclusive, x1/y1 are exclusive
+struct tile
+{
+	int x0, x1;
+	int y0, y1;
+	int index;  // position of the tile in the scheduler's tile list
+};
+
+// each worker thread owns one of these
+// the owner takes tiles from the front, other threads that have run out of work steal from the back
+// tiles are big enough (hundreds of pixels * samples per pixel) that a plain mutex per queue is cheap compared to the work in a tile
+class tile_queue
+{
+public:
+	void push(const tile& t)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		tiles.push_back(t);
+	}
+
+	bool pop(tile& t)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if(tiles.empty())
+			return false;
+		t = tiles.front();
+		tiles.pop_front();
+		return true;
+	}
+
+	bool steal(tile& t)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if(tiles.empty())
+			return false;
+		t = tiles.back();
+		tiles.pop_back();
+		return true;
+	}
+
+private:
+	std::mutex lock;
+	std::deque<tile> tiles;
+};
+
+// splits the image into tiles and deals them out to per-worker queues
+// when a worker's own queue is empty it steals from the other workers, so all threads stay busy until the last tile is taken
+// (with fixed bands of rows, the threads that got the expensive parts of the image would finish long after the others)
+class tile_scheduler
+{
+public:
+	tile_scheduler(int image_nx, int image_ny, int tile_size, int worker_count)
+		: queues(worker_count)
+	{
+		int tiles_x = (image_nx + tile_size-1) / tile_size;
+		int tiles_y = (image_ny + tile_size-1) / tile_size;
+		tile_count = tiles_x*tiles_y;
+
+		// each worker gets a contiguous run of tiles so neighbouring tiles (which usually hit the same objects) are rendered by the same thread
+		// tiles are ordered from the top of the image to the bottom to match the order the output file is written in
+		int index = 0;
+		for(int ty = tiles_y-1;
+			ty >= 0;
+			ty--)
+		{
+			for(int tx = 0;
+				tx < tiles_x;
+				tx++)
+			{
+				tile t;
+				t.x0 = tx*tile_size;
+				t.x1 = (t.x0 + tile_size < image_nx) ? t.x0 + tile_size : image_nx;
+				t.y0 = ty*tile_size;
+				t.y1 = (t.y0 + tile_size < image_ny) ? t.y0 + tile_size : image_ny;
+				t.index = index;
+				queues[(index*worker_count) / tile_count].push(t);
+				index++;
+			}
+		}
+	}
+
+	// returns false once there are no tiles left anywhere
+	bool next_tile(int worker, tile& t)
+	{
+		if(queues[worker].pop(t))
+			return true;
+		// own queue is empty, try stealing from the other workers (starting with the next one along so the thieves spread out)
+		int worker_count = (int)queues.size();
+		for(int i = 1;
+			i < worker_count;
+			i++)
+		{
+			if(queues[(worker+i) % worker_count].steal(t))
+				return true;
+		}
+		return false;
+	}
+
+	int tile_count;
+
+private:
+	std::vector<tile_queue> queues;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SIMDH
+#define SIMDH
+
+// thin wrappers around the SSE/AVX intrinsics so code can be written once for 'as many floats as the cpu can do at once'
+// float_lanes holds SIMD_WIDTH floats: 8 when compiled with AVX (/arch:AVX on msvc, -mavx on gcc/clang), otherwise 4 with SSE (always available on x64)
+// comparisons return a mask with all bits set in the lanes where the comparison was true, which can be combined with the and/or functions
+// or turned into an int with one bit per lane with lanes_mask
+
+#include <xmmintrin.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+
+const int SIMD_WIDTH = 8;
+typedef __m256 float_lanes;
+
+inline float_lanes lanes_set(float f)							{ return _mm256_set1_ps(f); }
+inline float_lanes lanes_load(const float *p)					{ return _mm256_loadu_ps(p); }
+inline void lanes_store(float *p, float_lanes a)				{ _mm256_storeu_ps(p, a); }
+inline float_lanes lanes_add(float_lanes a, float_lanes b)		{ return _mm256_add_ps(a, b); }
+inline float_lanes lanes_sub(float_lanes a, float_lanes b)		{ return _mm256_sub_ps(a, b); }
+inline float_lanes lanes_mul(float_lanes a, float_lanes b)		{ return _mm256_mul_ps(a, b); }
+inline float_lanes lanes_div(float_lanes a, float_lanes b)		{ return _mm256_div_ps(a, b); }
+inline float_lanes lanes_sqrt(float_lanes a)					{ return _mm256_sqrt_ps(a); }
+inline float_lanes lanes_min(float_lanes a, float_lanes b)		{ return _mm256_min_ps(a, b); }
+inline float_lanes lanes_max(float_lanes a, float_lanes b)		{ return _mm256_max_ps(a, b); }
+inline float_lanes lanes_greater(float_lanes a, float_lanes b)	{ return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline float_lanes lanes_less(float_lanes a, float_lanes b)		{ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline float_lanes lanes_and(float_lanes a, float_lanes b)		{ return _mm256_and_ps(a, b); }
+inline float_lanes lanes_or(float_lanes a, float_lanes b)		{ return _mm256_or_ps(a, b); }
+// picks b in the lanes where mask is set and a everywhere else
+inline float_lanes lanes_select(float_lanes a, float_lanes b, float_lanes mask) { return _mm256_blendv_ps(a, b, mask); }
+inline int lanes_mask(float_lanes mask)							{ return _mm256_movemask_ps(mask); }
+
+#else
+
+const int SIMD_WIDTH = 4;
+typedef __m128 float_lanes;
+
+inline float_lanes lanes_set(float f)							{ return _mm_set1_ps(f); }
+inline float_lanes lanes_load(const float *p)					{ return _mm_loadu_ps(p); }
+inline void lanes_store(float *p, float_lanes a)				{ _mm_storeu_ps(p, a); }
+inline float_lanes lanes_add(float_lanes a, float_lanes b)		{ return _mm_add_ps(a, b); }
+inline float_lanes lanes_sub(float_lanes a, float_lanes b)		{ return _mm_sub_ps(a, b); }
+inline float_lanes lanes_mul(float_lanes a, float_lanes b)		{ return _mm_mul_ps(a, b); }
+inline float_lanes lanes_div(float_lanes a, float_lanes b)		{ return _mm_div_ps(a, b); }
+inline float_lanes lanes_sqrt(float_lanes a)					{ return _mm_sqrt_ps(a); }
+inline float_lanes lanes_min(float_lanes a, float_lanes b)		{ return _mm_min_ps(a, b); }
+inline float_lanes lanes_max(float_lanes a, float_lanes b)		{ return _mm_max_ps(a, b); }
+inline float_lanes lanes_greater(float_lanes a, float_lanes b)	{ return _mm_cmpgt_ps(a, b); }
+inline float_lanes lanes_less(float_lanes a, float_lanes b)		{ return _mm_cmplt_ps(a, b); }
+inline float_lanes lanes_and(float_lanes a, float_lanes b)		{ return _mm_and_ps(a, b); }
+inline float_lanes lanes_or(float_lanes a, float_lanes b)		{ return _mm_or_ps(a, b); }
+// picks b in the lanes where mask is set and a everywhere else (SSE has no blend instruction before SSE4.1)
+inline float_lanes lanes_select(float_lanes a, float_lanes b, float_lanes mask) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+inline int lanes_mask(float_lanes mask)							{ return _mm_movemask_ps(mask); }
+
+#endif
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef SPHERESETH
+#define SPHERESETH
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "hitable.h"
+#include "material.h"
+#include "bvh.h"
+#include "trace.h"
+#include "simd.h"
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// most spheres in a group that gets turned into one sphere_set
+// one simd step per group measured fastest on scene 0, bigger groups make the bvh above them less able to skip spheres
+const int SPHERE_SET_SIZE = SIMD_WIDTH;
+
+// a group of spheres (static and moving) stored as 'structure of arrays': all of the x co-ordinates together, all of the y's together, etc.
+// a ray is tested against SIMD_WIDTH spheres at once (see simd.h), so a group costs a handful of simd loops
+// instead of a virtual call, a pointer to follow and a branchy quadratic for every sphere
+// the arrays are padded to a multiple of SIMD_WIDTH with spheres that can never be hit
+class sphere_set : public hitable
+{
+public:
+	// copies the centers, radii and materials of spheres, every object in spheres must be a sphere or a moving_sphere
+	sphere_set(hitable **spheres, int n);
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	virtual bool occluded(const ray& r, float t_min, float t_max) const;
+	virtual bool bounding_box(float t0, float t1, aabb& box) const;
+	virtual void finalize(const ray& r, hit_record& rec) const;
+
+	// center of sphere i at a given time
+	point center(int i, float time) const
+	{
+		return point(base_x[i] + time*velocity_x[i], base_y[i] + time*velocity_y[i], base_z[i] + time*velocity_z[i]);
+	}
+
+	int count;			// number of real spheres, the arrays are longer because of the padding
+	// a moving sphere's center is base + time*velocity, static spheres have a velocity of 0
+	std::vector<float> base_x, base_y, base_z;
+	std::vector<float> velocity_x, velocity_y, velocity_z;
+	std::vector<float> radius;
+	std::vector<float> radius_squared;
+	std::vector<int> material_index;		// index into materials
+	std::vector<material *> materials;		// every different material used by the spheres, once each
+	float box_time0, box_time1;				// the boxes of moving spheres are only known for one time range, see bounding_box()
+	aabb box;
+
+private:
+	// sets t_hit to the closest root of each sphere in the group starting at 'first' that is between t_min and t_max
+	// returns a mask with a bit set for every sphere that has such a root
+	int hit_group(int first, const ray& r, float a, float inv_a, float t_min, float t_max, float *t_hit) const;
+};
+
+sphere_set::sphere_set(hitable **spheres, int n) : count(n), box_time0(0), box_time1(1)
+{
+	int padded = ((n + SIMD_WIDTH-1) / SIMD_WIDTH) * SIMD_WIDTH;
+	// padding spheres have a NaN center, every comparison with NaN is false so they never count as a hit
+	float nan = std::numeric_limits<float>::quiet_NaN();
+	base_x.assign(padded, nan); base_y.assign(padded, nan); base_z.assign(padded, nan);
+	velocity_x.assign(padded, 0); velocity_y.assign(padded, 0); velocity_z.assign(padded, 0);
+	radius.assign(padded, 0);
+	radius_squared.assign(padded, 0);
+	material_index.assign(padded, 0);
+
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		point base;
+		point velocity(0, 0, 0);
+		material *m;
+		if(sphere *s = dynamic_cast<sphere *>(spheres[i]))
+		{
+			base = s->center;
+			radius[i] = s->radius;
+			m = s->mtrl;
+		}
+		else
+		{
+			moving_sphere *ms = dynamic_cast<moving_sphere *>(spheres[i]);
+			assert(ms);
+			// center(time) = center0 + (time-time0)/(time1-time0) * (center1-center0)
+			velocity = (ms->center1 - ms->center0) / (ms->time1 - ms->time0);
+			base = ms->center0 - ms->time0*velocity;
+			radius[i] = ms->radius;
+			m = ms->mtrl;
+		}
+		base_x[i] = base.x(); base_y[i] = base.y(); base_z[i] = base.z();
+		velocity_x[i] = velocity.x(); velocity_y[i] = velocity.y(); velocity_z[i] = velocity.z();
+		radius_squared[i] = radius[i]*radius[i];
+
+		std::vector<material *>::iterator found = std::find(materials.begin(), materials.end(), m);
+		material_index[i] = (int)(found - materials.begin());
+		if(found == materials.end())
+			materials.push_back(m);
+
+		aabb sphere_box;
+		spheres[i]->bounding_box(box_time0, box_time1, sphere_box);
+		box = (i == 0) ? sphere_box : surrounding_box(box, sphere_box);
+	}
+}
+
+// the same quadratic as sphere::hit, written with half of b so the 2's and 4's cancel out:
+// b' = dot(oc, B), discriminant' = b'*b' - a*c, t = (-b' -+ sqrt(discriminant')) / a
+int sphere_set::hit_group(int first, const ray& r, float a, float inv_a, float t_min, float t_max, float *t_hit) const
+{
+	RT_STAT_ADD(primitive_tests, count - first < SIMD_WIDTH ? count - first : SIMD_WIDTH);
+	float_lanes time = lanes_set(r.time());
+	float_lanes cx = lanes_add(lanes_load(&base_x[first]), lanes_mul(time, lanes_load(&velocity_x[first])));
+	float_lanes cy = lanes_add(lanes_load(&base_y[first]), lanes_mul(time, lanes_load(&velocity_y[first])));
+	float_lanes cz = lanes_add(lanes_load(&base_z[first]), lanes_mul(time, lanes_load(&velocity_z[first])));
+	// oc = origin - center
+	float_lanes ocx = lanes_sub(lanes_set(r.A.x()), cx);
+	float_lanes ocy = lanes_sub(lanes_set(r.A.y()), cy);
+	float_lanes ocz = lanes_sub(lanes_set(r.A.z()), cz);
+	float_lanes dx = lanes_set(r.B.x());
+	float_lanes dy = lanes_set(r.B.y());
+	float_lanes dz = lanes_set(r.B.z());
+
+	float_lanes b = lanes_add(lanes_add(lanes_mul(ocx, dx), lanes_mul(ocy, dy)), lanes_mul(ocz, dz));
+	float_lanes c = lanes_sub(lanes_add(lanes_add(lanes_mul(ocx, ocx), lanes_mul(ocy, ocy)), lanes_mul(ocz, ocz)), lanes_load(&radius_squared[first]));
+	float_lanes discriminant = lanes_sub(lanes_mul(b, b), lanes_mul(lanes_set(a), c));
+	// lanes with a negative discriminant get NaN roots here, which fail every comparison below
+	float_lanes root = lanes_sqrt(discriminant);
+	float_lanes inv_a_lanes = lanes_set(inv_a);
+	float_lanes zero = lanes_set(0.0f);
+	float_lanes t_near = lanes_mul(lanes_sub(lanes_sub(zero, b), root), inv_a_lanes);
+	float_lanes t_far = lanes_mul(lanes_add(lanes_sub(zero, b), root), inv_a_lanes);
+
+	float_lanes lo = lanes_set(t_min);
+	float_lanes hi = lanes_set(t_max);
+	float_lanes near_ok = lanes_and(lanes_greater(t_near, lo), lanes_less(t_near, hi));
+	float_lanes far_ok = lanes_and(lanes_greater(t_far, lo), lanes_less(t_far, hi));
+	float_lanes ok = lanes_and(lanes_or(near_ok, far_ok), lanes_greater(discriminant, zero));
+	// the near root wins if it is in range, otherwise the far root (the ray started inside the sphere)
+	lanes_store(t_hit, lanes_select(t_far, t_near, near_ok));
+	return lanes_mask(ok);
+}
+
+bool sphere_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+	float a = dot(r.B, r.B);
+	float inv_a = 1.0f / a;
+	float closest_so_far = t_max;
+	int closest = -1;
+	float t_hit[SIMD_WIDTH];
+	for(int first = 0;
+		first < count;
+		first += SIMD_WIDTH)
+	{
+		int mask = hit_group(first, r, a, inv_a, t_min, closest_so_far, t_hit);
+		// only the lanes that were hit are looked at one by one, most groups are missed entirely
+		while(mask)
+		{
+			int lane = 0;
+			while(!(mask & (1 << lane)))
+				lane++;
+			mask &= ~(1 << lane);
+			if(t_hit[lane] < closest_so_far)
+			{
+				closest_so_far = t_hit[lane];
+				closest = first + lane;
+			}
+		}
+	}
+	if(closest < 0)
+		return false;
+
+	rec.t = closest_so_far;
+	rec.obj = this;
+	rec.prim = closest;
+	return true;
+}
+
+void sphere_set::finalize(const ray& r, hit_record& rec) const
+{
+	int i = rec.prim;
+	rec.hit_point = r.point_at_parameter(rec.t);
+	rec.normal = (rec.hit_point - center(i, r.time())) / radius[i];
+	rec.mat_ptr = materials[material_index[i]];
+	get_sphere_uv(rec.normal, rec.u, rec.v);
+}
+
+bool sphere_set::occluded(const ray& r, float t_min, float t_max) const
+{
+	float a = dot(r.B, r.B);
+	float inv_a = 1.0f / a;
+	float t_hit[SIMD_WIDTH];
+	for(int first = 0;
+		first < count;
+		first += SIMD_WIDTH)
+	{
+		if(hit_group(first, r, a, inv_a, t_min, t_max, t_hit))
+			return true;
+	}
+	return false;
+}
+
+bool sphere_set::bounding_box(float t0, float t1, aabb& b) const
+{
+	if(t0 < box_time0 || t1 > box_time1)
+	{
+		// a moving sphere can leave the box it had between time 0 and 1, work out the box for this time range
+		for(int i = 0;
+			i < count;
+			i++)
+		{
+			point r(radius[i], radius[i], radius[i]);
+			aabb sphere_box = surrounding_box(aabb(center(i, t0) - r, center(i, t0) + r),
+											  aabb(center(i, t1) - r, center(i, t1) + r));
+			b = (i == 0) ? sphere_box : surrounding_box(b, sphere_box);
+		}
+		return true;
+	}
+	b = box;
+	return true;
+}
+
+// puts the spheres of prims into sphere_sets of at most SPHERE_SET_SIZE spheres that are close together
+// groups are made by splitting with the same SAH partition the bvh builder uses, so each group has a small box
+// the groups are appended to out, a 'group' of one sphere is added as the sphere itself
+void sphere_set_groups(scene_arena& arena, bvh_build_prim *prims, int n, hitable **spheres, std::vector<hitable *>& out)
+{
+	if(n > SPHERE_SET_SIZE)
+	{
+		int left_count = bvh_sah_partition(prims, n, SPHERE_SET_SIZE);
+		sphere_set_groups(arena, prims, left_count, spheres, out);
+		sphere_set_groups(arena, prims + left_count, n - left_count, spheres, out);
+		return;
+	}
+	if(n == 1)
+	{
+		out.push_back(spheres[prims[0].index]);
+		return;
+	}
+	std::vector<hitable *> group(n);
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		group[i] = spheres[prims[i].index];
+	}
+	out.push_back(arena.make<sphere_set>(&group[0], n));
+}
+
+// replaces the spheres and moving_spheres in list with sphere_sets, returns the new number of objects in list (never more than n)
+// left alone are:
+// spheres with emissive materials, so the light_list can keep sampling them one by one
+// spheres that are much bigger than the rest (e.g. a sphere used as the ground), they would make the box of their group cover the whole scene
+int pack_spheres(scene_arena& arena, hitable **list, int n)
+{
+	TRACE_SCOPE("pack_spheres");
+	std::vector<hitable *> spheres;
+	std::vector<hitable *> others;
+	std::vector<float> areas;
+	aabb temp_box;
+	for(int i = 0;
+		i < n;
+		i++)
+	{
+		bool is_sphere = dynamic_cast<sphere *>(list[i]) || dynamic_cast<moving_sphere *>(list[i]);
+		material *m = list[i]->get_material();
+		if(is_sphere && !(m && m->is_emissive()))
+		{
+			spheres.push_back(list[i]);
+			list[i]->bounding_box(0, 1, temp_box);
+			areas.push_back(temp_box.surface_area());
+		}
+		else
+		{
+			others.push_back(list[i]);
+		}
+	}
+	if(spheres.size() < 2)
+		return n;
+
+	std::vector<float> sorted_areas = areas;
+	std::nth_element(sorted_areas.begin(), sorted_areas.begin() + sorted_areas.size()/2, sorted_areas.end());
+	float median_area = sorted_areas[sorted_areas.size()/2];
+
+	std::vector<bvh_build_prim> prims;
+	for(size_t i = 0;
+		i < spheres.size();
+		i++)
+	{
+		if(areas[i] > 100.0f*median_area)
+		{
+			others.push_back(spheres[i]);
+			continue;
+		}
+		bvh_build_prim p;
+		spheres[i]->bounding_box(0, 1, p.box);
+		p.centroid = 0.5f*(p.box.min() + p.box.max());
+		p.index = (int)i;
+		prims.push_back(p);
+	}
+	if(prims.empty())
+		return n;
+	sphere_set_groups(arena, &prims[0], (int)prims.size(), &spheres[0], others);
+
+	for(size_t i = 0;
+		i < others.size();
+		i++)
+	{
+		list[i] = others[i];
+	}
+	return (int)others.size();
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef STATSH
+#define STATSH
+
+#include <stdio.h>
+#include <stdint.h>
+
+// counters for the hot paths of the renderer (how many boxes and primitives each ray is tested against, how long paths are...)
+// they are only compiled in when RT_STATS is defined (add -DRT_STATS to the cl line in build.bat), otherwise RT_STAT() and
+// RT_STAT_ADD() are empty and cost nothing
+// ----
+// every thread counts into its own render_counters (see thread_counters()) so the hot paths never touch shared memory or atomics
+// each render thread copies its counters into its worker_stats when it finishes, and they are added up once the render is done
+
+// paths that bounce this many times or more all go in the last bucket of the histogram
+const int RT_STATS_MAX_BOUNCES = 64;
+
+struct render_counters
+{
+	uint64_t bvh_nodes_visited;		// nodes of any bvh (bvh_node, linear_bvh, bvh4, a mesh's or an instance_bvh's) whose children or leaf were looked at
+	uint64_t box_tests;				// ray/box slab tests, the 4 boxes a bvh4 node tests at once count as 4
+	uint64_t primitive_tests;		// ray tests against spheres, rects, boxes and triangles, a sphere_set counts each sphere
+	uint64_t path_bounces[RT_STATS_MAX_BOUNCES];	// paths by how many scattered rays color() traced before it stopped following them
+	uint64_t unit_sphere_calls;		// random_in_unit_sphere() calls
+	uint64_t unit_sphere_tries;		// points it made before finding one inside the sphere
+	uint64_t unit_disk_calls;		// random_in_unit_disk() calls
+	uint64_t unit_disk_tries;
+
+	render_counters()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		bvh_nodes_visited = 0;
+		box_tests = 0;
+		primitive_tests = 0;
+		for(int i = 0;
+			i < RT_STATS_MAX_BOUNCES;
+			i++)
+		{
+			path_bounces[i] = 0;
+		}
+		unit_sphere_calls = 0;
+		unit_sphere_tries = 0;
+		unit_disk_calls = 0;
+		unit_disk_tries = 0;
+	}
+
+	void add(const render_counters& other)
+	{
+		bvh_nodes_visited += other.bvh_nodes_visited;
+		box_tests += other.box_tests;
+		primitive_tests += other.primitive_tests;
+		for(int i = 0;
+			i < RT_STATS_MAX_BOUNCES;
+			i++)
+		{
+			path_bounces[i] += other.path_bounces[i];
+		}
+		unit_sphere_calls += other.unit_sphere_calls;
+		unit_sphere_tries += other.unit_sphere_tries;
+		unit_disk_calls += other.unit_disk_calls;
+		unit_disk_tries += other.unit_disk_tries;
+	}
+
+	void path_ended(int bounces)
+	{
+		path_bounces[bounces < RT_STATS_MAX_BOUNCES ? bounces : RT_STATS_MAX_BOUNCES-1]++;
+	}
+};
+
+// prints the counters, per ray where that makes sense
+// traced_rays is every ray sent into the scene (camera, scattered and shadow rays), paths is the number of camera rays
+void print_render_counters(const render_counters& c, uint64_t traced_rays, uint64_t paths)
+{
+	double rays = traced_rays > 0 ? (double)traced_rays : 1.0;
+	printf("bvh nodes visited: %llu (%.2f per ray)\n", (unsigned long long)c.bvh_nodes_visited, c.bvh_nodes_visited / rays);
+	printf("box tests:         %llu (%.2f per ray)\n", (unsigned long long)c.box_tests, c.box_tests / rays);
+	printf("primitive tests:   %llu (%.2f per ray)\n", (unsigned long long)c.primitive_tests, c.primitive_tests / rays);
+	printf("random_in_unit_sphere: %llu calls, %.3f tries per call\n", (unsigned long long)c.unit_sphere_calls,
+		   c.unit_sphere_calls > 0 ? (double)c.unit_sphere_tries / c.unit_sphere_calls : 0.0);
+	printf("random_in_unit_disk:   %llu calls, %.3f tries per call\n", (unsigned long long)c.unit_disk_calls,
+		   c.unit_disk_calls > 0 ? (double)c.unit_disk_tries / c.unit_disk_calls : 0.0);
+	// the histogram stops at the longest path, the last bucket also holds everything longer
+	int last = 0;
+	for(int i = 0;
+		i < RT_STATS_MAX_BOUNCES;
+		i++)
+	{
+		if(c.path_bounces[i] > 0)
+			last = i;
+	}
+	printf("scattered rays traced before a path ended:\n");
+	for(int i = 0;
+		i <= last;
+		i++)
+	{
+		printf("  %2d%s %12llu (%5.2f%%)\n", i, i == RT_STATS_MAX_BOUNCES-1 ? "+" : " ", (unsigned long long)c.path_bounces[i],
+			   paths > 0 ? 100.0 * c.path_bounces[i] / paths : 0.0);
+	}
+}
+
+#ifdef RT_STATS
+inline render_counters& thread_counters()
+{
+	static thread_local render_counters counters;
+	return counters;
+}
+#define RT_STAT(counter) (thread_counters().counter++)
+#define RT_STAT_ADD(counter, n) (thread_counters().counter += (n))
+#define RT_STAT_PATH_ENDED(bounces) (thread_counters().path_ended(bounces))
+#else
+#define RT_STAT(counter) ((void)0)
+#define RT_STAT_ADD(counter, n) ((void)0)
+#define RT_STAT_PATH_ENDED(bounces) ((void)0)
+#endif
+
+#endif
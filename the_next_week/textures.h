@@ -3,6 +3,7 @@
 
 #include "vec3.h"
 #include "perlin.h"
+#include "trace.h"
 
 #pragma warning(push, 0) // disable compiler warnings
 #define  STB_IMAGE_IMPLEMENTATION
@@ -20,7 +21,7 @@ class constant_texture : public texture
 {
 public:
 	constant_texture() {}
-	constant_texture(rgb& c) : color(c) {}
+	constant_texture(const rgb& c) : color(c) {}
 	virtual rgb value(float u, float v, const point& hit_point) const
 	{
 		return color;
@@ -72,17 +73,19 @@ public:
 	//image_texture(unsigned char *pixels, int A, int B) : data(pixels), width(A), height(B) {}
 	image_texture(const char *image_filename)
 	{
+		TRACE_SCOPE("stbi_load");
 		int bytes_per_pixel;
 		// creates an array of unsigned chars with the image data
 		// the format is: for each pixel there is 1 byte for r, 1 byte for g, 1 byte for b
 		// indexes 0 to width is the first row of pixels in the image, width+1 to 2*width is the second row, etc.
+		// data is NULL if the file couldn't be loaded, whoever makes the texture checks valid()
 		data = stbi_load(image_filename, &width, &height, &bytes_per_pixel, 3);
-		assert(data != NULL);
 	}
 	~image_texture()
 	{
 		stbi_image_free(data);
 	}
+	bool valid() const { return data != NULL; }
 	virtual rgb value(float u, float v, const point& p) const;
 	unsigned char *data;
 	int width, height;
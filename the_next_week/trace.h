@@ -0,0 +1,192 @@
+#ifndef TRACEH
+#define TRACEH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+// a timeline of what every thread was doing, written as chrome trace event json
+// open the file in chrome://tracing or https://ui.perfetto.dev to see the scene build, bvh builds, texture loads, every tile
+// each render thread worked on and the output encoding on one timeline, which shows threads sitting idle, uneven work and
+// the parts of main() that only run on one thread
+// ----
+// tracing is off until trace_start() is called (main does that for -trace <file>), until then a TRACE_SCOPE only checks one bool
+// a TRACE_SCOPE("name") records how long the rest of its block takes, names have to be string literals (only the pointer is kept)
+// every thread writes its events into its own ring buffer, so recording an event takes no lock
+// a buffer holds the last TRACE_BUFFER_SIZE events of its thread, older ones are dropped (and counted) when it is full
+
+const int TRACE_BUFFER_SIZE = 1 << 16;
+
+struct trace_event
+{
+	const char *name;
+	uint64_t start_ns;		// since trace_start()
+	uint64_t duration_ns;
+	int32_t arg;			// shown as 'n' in the event's args, -1 for none (e.g. the tile index)
+};
+
+struct trace_buffer
+{
+	trace_buffer(int thread_id) : id(thread_id), count(0), events(TRACE_BUFFER_SIZE) {}
+	int id;
+	std::string thread_name;
+	uint64_t count;			// events ever recorded, the newest is at (count-1) % TRACE_BUFFER_SIZE
+	std::vector<trace_event> events;
+};
+
+// everything shared between threads, only touched when a thread makes its buffer and when the trace is written
+struct trace_state
+{
+	trace_state() : enabled(false) {}
+	~trace_state()
+	{
+		for(size_t i = 0;
+			i < buffers.size();
+			i++)
+		{
+			delete buffers[i];
+		}
+	}
+	bool enabled;
+	std::chrono::steady_clock::time_point start;
+	std::mutex lock;
+	std::vector<trace_buffer *> buffers;
+};
+
+inline trace_state& global_trace()
+{
+	static trace_state state;
+	return state;
+}
+
+inline bool trace_enabled()
+{
+	return global_trace().enabled;
+}
+
+// the calling thread's buffer, made the first time the thread records something
+inline trace_buffer *thread_trace_buffer()
+{
+	static thread_local trace_buffer *buffer = NULL;
+	if(!buffer)
+	{
+		trace_state& state = global_trace();
+		std::lock_guard<std::mutex> guard(state.lock);
+		buffer = new trace_buffer((int)state.buffers.size());
+		state.buffers.push_back(buffer);
+	}
+	return buffer;
+}
+
+inline uint64_t trace_now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - global_trace().start).count();
+}
+
+// call before any of the threads that should be traced are started
+void trace_start()
+{
+	trace_state& state = global_trace();
+	state.start = std::chrono::steady_clock::now();
+	state.enabled = true;
+}
+
+// the name the calling thread gets on the timeline, threads that don't set one are called 'thread <n>'
+void trace_thread_name(const std::string& name)
+{
+	if(trace_enabled())
+		thread_trace_buffer()->thread_name = name;
+}
+
+inline void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, int32_t arg)
+{
+	trace_buffer *buffer = thread_trace_buffer();
+	trace_event& e = buffer->events[buffer->count % TRACE_BUFFER_SIZE];
+	e.name = name;
+	e.start_ns = start_ns;
+	e.duration_ns = end_ns - start_ns;
+	e.arg = arg;
+	buffer->count++;
+}
+
+// records the time from its construction to the end of its scope
+class trace_scope
+{
+public:
+	trace_scope(const char *event_name, int32_t event_arg = -1) : name(NULL)
+	{
+		if(trace_enabled())
+		{
+			name = event_name;
+			arg = event_arg;
+			start_ns = trace_now_ns();
+		}
+	}
+	~trace_scope()
+	{
+		if(name)
+			trace_record(name, start_ns, trace_now_ns(), arg);
+	}
+
+private:
+	const char *name;
+	int32_t arg;
+	uint64_t start_ns;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// TRACE_SCOPE("name") or TRACE_SCOPE("name", number)
+#define TRACE_SCOPE(...) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+// writes every thread's events as chrome trace json, the threads that are recording must have finished
+// returns false if the file couldn't be written
+bool trace_write(const char *file_name)
+{
+	trace_state& state = global_trace();
+	FILE *f = fopen(file_name, "w");
+	if(!f)
+	{
+		printf("couldn't write %s\n", file_name);
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(state.lock);
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	uint64_t dropped = 0;
+	for(size_t b = 0;
+		b < state.buffers.size();
+		b++)
+	{
+		const trace_buffer *buffer = state.buffers[b];
+		std::string thread_name = buffer->thread_name.empty() ? "thread " + std::to_string(buffer->id) : buffer->thread_name;
+		// the viewer sorts threads by sort_index, which keeps them in the order they first recorded something
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", first ? "" : ",", buffer->id, thread_name.c_str());
+		fprintf(f, "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", buffer->id, buffer->id);
+		first = false;
+
+		uint64_t oldest = buffer->count > (uint64_t)TRACE_BUFFER_SIZE ? buffer->count - TRACE_BUFFER_SIZE : 0;
+		dropped += oldest;
+		for(uint64_t i = oldest;
+			i < buffer->count;
+			i++)
+		{
+			const trace_event& e = buffer->events[i % TRACE_BUFFER_SIZE];
+			// timestamps are in microseconds
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", e.name, buffer->id, e.start_ns / 1000.0, e.duration_ns / 1000.0);
+			if(e.arg >= 0)
+				fprintf(f, ",\"args\":{\"n\":%d}", e.arg);
+			fprintf(f, "}");
+		}
+	}
+	fprintf(f, "\n]}\n");
+	bool ok = fclose(f) == 0;
+	if(dropped > 0)
+		printf("the trace dropped its %llu oldest events, the ring buffers were full\n", (unsigned long long)dropped);
+	return ok;
+}
+
+#endif
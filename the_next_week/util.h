@@ -2,23 +2,42 @@
 #define UTILH
 
 #include <stdlib.h>
+#include "rng.h"
+#include "stats.h"
 
-// returns random doubles in the range: 0 <= val < 1
-inline double my_rand()
+// returns random floats in the range: 0 <= val < 1
+// draws from the calling thread's generator (see rng.h)
+// building with LIBC_RAND defined switches back to the old rand() based version, this is only kept so the benchmark can compare the two
+#ifndef LIBC_RAND
+inline float my_rand()
+{
+	return thread_rng().next_float();
+}
+#else
+inline float my_rand()
 {
 	int r = rand() % 99;
-	return static_cast<double>(r) / 100.0;
+	return static_cast<float>(r) / 100.0f;
 }
+#endif
 
 point random_in_unit_sphere()
 {
 	point p;
+	RT_STAT(unit_sphere_calls);
 	do
 	{
+		RT_STAT(unit_sphere_tries);
 		// produces (x, y, z) values that range from almost -1 to almost 1
 		p = 2.0*point(my_rand(), my_rand(), my_rand()) - point(1,1,1);
 	} while (p.squared_length() >= 1.0);
 	return p;
 }
 
+// a random point on the surface of a unit sphere (a random direction where every direction is equally likely)
+point random_unit_vector()
+{
+	return unit_vector(random_in_unit_sphere());
+}
+
 #endif